@@ -0,0 +1,173 @@
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+// Blocked Bloom filter to reject keys that are not in the index
+// without doing a binary search.
+// Every key sets one bit in each of the eight words of a single 64 byte block,
+// so a lookup touches at most two cache lines.
+// Saved filters (see saveIndexFilter in DBIndex.h) start with a header that ties them to the index they were built from.
+//
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+class BlockedBloomFilter {
+public:
+    static const size_t WORDS_PER_BLOCK = 8;
+    static const size_t BITS_PER_KEY = 12;
+
+    // one block in size, so the blocks after it stay cache line aligned
+    struct FileHeader {
+        static const uint64_t MAGIC = 0x544C4946424450ULL;
+
+        uint64_t magic;
+        uint64_t entries;
+        uint64_t blocks;
+        // identifies the index the filter was built from, e.g. the content hash of its cache
+        uint64_t identity;
+        uint64_t reserved[4];
+    };
+
+    BlockedBloomFilter() : blocks(NULL), numBlocks(0), numEntries(0), mapped(NULL), mappedSize(0) { }
+
+    ~BlockedBloomFilter() {
+        release();
+    }
+
+    void init(size_t entries) {
+        release();
+        numEntries = entries;
+        numBlocks = blocksFor(entries);
+        storage.assign(numBlocks * WORDS_PER_BLOCK, 0);
+        blocks = storage.data();
+    }
+
+    void add(uint64_t hash) {
+        uint64_t *block = blocks + blockIndex(hash) * WORDS_PER_BLOCK;
+        uint64_t bits = mix(hash);
+        for (size_t i = 0; i < WORDS_PER_BLOCK; i++) {
+            block[i] |= 1ULL << ((bits >> (i * 6)) & 63);
+        }
+    }
+
+    bool mayContain(uint64_t hash) const {
+        const uint64_t *block = blocks + blockIndex(hash) * WORDS_PER_BLOCK;
+        uint64_t bits = mix(hash);
+        uint64_t missing = 0;
+        for (size_t i = 0; i < WORDS_PER_BLOCK; i++) {
+            missing |= ~block[i] & (1ULL << ((bits >> (i * 6)) & 63));
+        }
+        return missing == 0;
+    }
+
+    // uses filter blocks that are owned by someone else, e.g. a shared memory segment
+    void attach(const uint64_t *data, size_t bytes) {
+        release();
+        blocks = const_cast<uint64_t *>(data);
+        numBlocks = bytes / (WORDS_PER_BLOCK * sizeof(uint64_t));
+    }
+
+    const uint64_t *data() const {
+        return blocks;
+    }
+
+    size_t entries() const {
+        return numEntries;
+    }
+
+    size_t blockCount() const {
+        return numBlocks;
+    }
+
+    size_t byteSize() const {
+        return numBlocks * WORDS_PER_BLOCK * sizeof(uint64_t);
+    }
+
+    bool operator==(const BlockedBloomFilter &other) const {
+        return numEntries == other.numEntries && numBlocks == other.numBlocks
+               && memcmp(blocks, other.blocks, byteSize()) == 0;
+    }
+
+    // maps a filter previously written with saveIndexFilter, returns false if there is none
+    // or if it was built for a different index than entries and identity describe
+    bool load(const std::string &fileName, size_t entries, uint64_t identity) {
+        FILE *file = fopen(fileName.c_str(), "rb");
+        if (file == NULL) {
+            return false;
+        }
+
+        struct stat sb;
+        size_t blockSize = WORDS_PER_BLOCK * sizeof(uint64_t);
+        size_t expectedBlocks = blocksFor(entries);
+        if (fstat(fileno(file), &sb) != 0
+            || static_cast<size_t>(sb.st_size) != sizeof(FileHeader) + expectedBlocks * blockSize) {
+            fclose(file);
+            return false;
+        }
+
+        void *map = mmap(NULL, static_cast<size_t>(sb.st_size), PROT_READ, MAP_SHARED, fileno(file), 0);
+        fclose(file);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+
+        const FileHeader *header = static_cast<const FileHeader *>(map);
+        if (header->magic != FileHeader::MAGIC || header->entries != entries || header->blocks != expectedBlocks
+            || header->identity != identity) {
+            munmap(map, static_cast<size_t>(sb.st_size));
+            return false;
+        }
+
+        release();
+        mapped = map;
+        mappedSize = static_cast<size_t>(sb.st_size);
+        blocks = reinterpret_cast<uint64_t *>(static_cast<char *>(map) + sizeof(FileHeader));
+        numBlocks = expectedBlocks;
+        numEntries = entries;
+        return true;
+    }
+
+private:
+    uint64_t *blocks;
+    size_t numBlocks;
+    size_t numEntries;
+    std::vector<uint64_t> storage;
+
+    void *mapped;
+    size_t mappedSize;
+
+    void release() {
+        if (mapped != NULL) {
+            munmap(mapped, mappedSize);
+            mapped = NULL;
+            mappedSize = 0;
+        }
+        storage.clear();
+        blocks = NULL;
+        numBlocks = 0;
+        numEntries = 0;
+    }
+
+    static size_t blocksFor(size_t entries) {
+        size_t count = (entries * BITS_PER_KEY + 511) / 512;
+        return count == 0 ? 1 : count;
+    }
+
+    size_t blockIndex(uint64_t hash) const {
+        return static_cast<size_t>(((hash & 0xffffffffULL) * numBlocks) >> 32);
+    }
+
+    static uint64_t mix(uint64_t hash) {
+        // the six bit fields are taken from the well mixed upper 48 bits
+        return (hash * 0x9E3779B97F4A7C15ULL) >> 16;
+    }
+};
+
+#endif
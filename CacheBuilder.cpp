@@ -0,0 +1,267 @@
+// dbreader_cache prebuilds the index cache, key filter and lookup cache of ffindex DBs,
+// so that no PHP request has to build them on its first open.
+// Every index is checked against its data file before the cache is written,
+// filter and lookup cache are always rebuilt, or in check mode compared with rebuilt ones.
+//
+
+#include "DBIndex.h"
+#include "LookupIndex.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// USE_DATA and USE_WRITABLE of DBReader, the other modes share their caches
+static const int USE_DATA = 1;
+static const int CACHE_MODES = 3;
+
+struct Options {
+    int mode;
+    bool stringKeys;
+    bool checkOnly;
+};
+
+void printUsage() {
+    std::cerr << "Usage: dbreader_cache [-t threads] [-m mode] [-s] [-c] <db>...\n"
+              << "Builds <db>.index.cache.* for DBs that are opened with the given DBReader mode.\n"
+              << "  -t  number of DBs processed in parallel (default: number of cores)\n"
+              << "  -m  mode the DBs are opened with, USE_SHARED and USE_PREAD are ignored (default: 1)\n"
+              << "  -s  build caches for StringDBReader instead of IntDBReader\n"
+              << "  -c  only check that the existing caches are up to date\n";
+}
+
+template<typename T>
+bool sameIndex(const IndexEntry<T> *x, const IndexEntry<T> *y, size_t size) {
+    // the padding of the entries is not initialized, so compare field by field
+    for (size_t i = 0; i < size; i++) {
+        if (memcmp(&x[i].id, &y[i].id, sizeof(T)) != 0 || x[i].offset != y[i].offset || x[i].length != y[i].length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns true if the cache in fileName contains exactly the given index
+template<typename T>
+bool cacheMatches(const std::string &fileName, const IndexEntry<T> *index, size_t size, uint64_t contentHash) {
+    size_t cacheSize;
+    uint64_t cacheHash;
+    IndexEntry<T> *cache = mapIndexCache<T>(fileName, &cacheSize, &cacheHash);
+    if (cache == NULL) {
+        return false;
+    }
+
+    bool matches = cacheSize == size && cacheHash == contentHash && sameIndex<T>(cache, index, size);
+    unmapIndexCache<T>(cache, cacheSize);
+    return matches;
+}
+
+// returns true if fileName contains exactly the given bytes
+bool fileMatches(const std::string &fileName, const std::string &contents) {
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    std::vector<char> buffer(64 * 1024);
+    size_t pos = 0;
+    bool matches = true;
+    while (matches) {
+        size_t got = fread(buffer.data(), sizeof(char), buffer.size(), file);
+        if (got == 0) {
+            break;
+        }
+        matches = pos + got <= contents.size() && memcmp(buffer.data(), contents.data() + pos, got) == 0;
+        pos += got;
+    }
+    matches = matches && ferror(file) == 0 && pos == contents.size();
+    fclose(file);
+    return matches;
+}
+
+template<typename T>
+void verifyData(const std::string &dataFileName, const IndexEntry<T> *index, size_t size) {
+    FILE *file = fopen(dataFileName.c_str(), "r");
+    if (file == NULL) {
+        std::ostringstream message;
+        message << "Could not open data file " << dataFileName;
+        throw std::runtime_error(message.str());
+    }
+
+    ssize_t dataSize;
+    char *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && ftell(file) > 0) {
+        data = mmapData(file, &dataSize, false);
+    } else {
+        dataSize = 0;
+    }
+    fclose(file);
+    if (data == MAP_FAILED) {
+        std::ostringstream message;
+        message << "Could not read data file " << dataFileName;
+        throw std::runtime_error(message.str());
+    }
+
+    try {
+        verifyIndex<T>(index, size, data, static_cast<size_t>(dataSize));
+    } catch (...) {
+        if (data != NULL) {
+            munmap(data, static_cast<size_t>(dataSize));
+        }
+        throw;
+    }
+    if (data != NULL) {
+        munmap(data, static_cast<size_t>(dataSize));
+    }
+}
+
+// returns a line describing what was done, throws if the DB or its cache is broken
+template<typename T>
+std::string buildCaches(const std::string &dataFileName, const Options &options) {
+    std::string indexFileName = dataFileName + ".index";
+    std::string cacheFileName = indexCacheFileName<T>(indexFileName, options.mode);
+
+    size_t size = countLines(indexFileName);
+    std::unique_ptr<IndexEntry<T>[]> index(new IndexEntry<T>[size]);
+    readIndexFile<T>(indexFileName, options.mode & USE_DATA, index.get(), size);
+    sortIndexEntries<T>(index.get(), size);
+
+    if (options.mode & USE_DATA) {
+        verifyData<T>(dataFileName, index.get(), size);
+    }
+
+    std::ostringstream result;
+    result << dataFileName << ": " << size << " entries";
+
+    uint64_t identity = hashIndex<T>(index.get(), size);
+    if (cacheMatches<T>(cacheFileName, index.get(), size, identity)) {
+        result << ", cache up to date";
+    } else if (options.checkOnly) {
+        std::ostringstream message;
+        message << "Cache " << cacheFileName << " is missing or out of date";
+        throw std::runtime_error(message.str());
+    } else {
+        saveIndexCache<T>(cacheFileName, index.get(), size);
+        result << ", cache written";
+    }
+
+    // readers reuse the filter next to a cache they did not build themselves, so it has to match the index
+    BlockedBloomFilter filter;
+    buildIndexFilter<T>(filter, index.get(), size);
+    std::string filterFileName = cacheFileName + ".filter";
+    if (options.checkOnly) {
+        BlockedBloomFilter saved;
+        if (!saved.load(filterFileName, size, identity) || !(saved == filter)) {
+            std::ostringstream message;
+            message << "Key filter " << filterFileName << " is missing or out of date";
+            throw std::runtime_error(message.str());
+        }
+    } else {
+        saveIndexFilter(filterFileName, filter, identity);
+    }
+
+    std::string lookupFileName = dataFileName + ".lookup";
+    if (fileExists(lookupFileName)) {
+        std::string lookupCacheFileName = lookupFileName + ".cache";
+        std::string lookupCache = LookupIndex::build(lookupFileName);
+        if (options.checkOnly) {
+            if (!fileMatches(lookupCacheFileName, lookupCache)) {
+                std::ostringstream message;
+                message << "Lookup cache " << lookupCacheFileName << " is missing or out of date";
+                throw std::runtime_error(message.str());
+            }
+        } else {
+            writeFileAtomically(lookupCacheFileName, {{lookupCache.data(), lookupCache.size()}});
+        }
+
+        LookupIndex lookup;
+        lookup.open(lookupFileName);
+        result << ", " << lookup.size() << " accessions";
+    }
+
+    return result.str();
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    options.mode = USE_DATA;
+    options.stringKeys = false;
+    options.checkOnly = false;
+    unsigned threads = std::thread::hardware_concurrency();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:sch")) != -1) {
+        switch (opt) {
+            case 't':
+                threads = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+                break;
+            case 'm':
+                options.mode = static_cast<int>(strtol(optarg, NULL, 10)) & CACHE_MODES;
+                break;
+            case 's':
+                options.stringKeys = true;
+                break;
+            case 'c':
+                options.checkOnly = true;
+                break;
+            default:
+                printUsage();
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    std::vector<std::string> dbs(argv + optind, argv + argc);
+    if (dbs.empty()) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    if (threads > dbs.size()) {
+        threads = static_cast<unsigned>(dbs.size());
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::mutex outputMutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < dbs.size(); i = next++) {
+            try {
+                std::string result = options.stringKeys ? buildCaches<char[32]>(dbs[i], options)
+                                                        : buildCaches<int32_t>(dbs[i], options);
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cout << result << std::endl;
+            } catch (const std::exception &e) {
+                failed = true;
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cerr << dbs[i] << ": " << e.what() << std::endl;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (size_t t = 0; t < pool.size(); t++) {
+        pool[t].join();
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
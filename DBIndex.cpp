@@ -0,0 +1,281 @@
+#include "DBIndex.h"
+#include "DBKey.h"
+
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <typeinfo>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool fileExists(const std::string& name) {
+    struct stat st;
+    return stat(name.c_str(), &st) == 0;
+}
+
+void writeFileAtomically(const std::string &fileName, const std::vector<FilePart> &parts) {
+    std::string tmpFileName = fileName + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(tmpFileName.c_str(), "w+b");
+    if (file == NULL) {
+        std::ostringstream message;
+        message << "Could not write " << fileName;
+        throw std::runtime_error(message.str());
+    }
+
+    bool written = true;
+    for (size_t i = 0; i < parts.size() && written; i++) {
+        written = fwrite(parts[i].data, sizeof(char), parts[i].bytes, file) == parts[i].bytes;
+    }
+    if (fclose(file) != 0 || !written || rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+        remove(tmpFileName.c_str());
+        std::ostringstream message;
+        message << "Could not write " << fileName;
+        throw std::runtime_error(message.str());
+    }
+}
+
+size_t countLines(const std::string& name) {
+    std::ifstream index(name);
+    if (index.fail()) {
+        std::ostringstream message;
+        message << "Could not open file " << name;
+        throw std::runtime_error(message.str());
+    }
+
+    size_t cnt = 0;
+    std::vector<char> buffer(1024 * 1024);
+    index.read(buffer.data(), buffer.size());
+    while (ptrdiff_t r = index.gcount()) {
+        for (size_t i = 0; i < r; i++) {
+            const char *p = buffer.data();
+            if (p[i] == '\n') {
+                cnt++;
+            }
+        }
+        index.read(buffer.data(), buffer.size());
+    }
+    index.close();
+
+    return cnt;
+}
+
+char *mmapData(FILE *file, ssize_t *dataSize, bool writable) {
+    struct stat sb;
+    fstat(fileno(file), &sb);
+    *dataSize = sb.st_size;
+
+    int fd = fileno(file);
+    int mode = PROT_READ;
+    if (writable) {
+        mode |= PROT_WRITE;
+    }
+    return static_cast<char *>(mmap(NULL, static_cast<size_t>(*dataSize), mode, MAP_PRIVATE, fd, 0));
+}
+
+template<typename T>
+std::string indexCacheFileName(const std::string &indexFileName, int mode) {
+    std::string cacheFileName = indexFileName;
+    cacheFileName.append(".cache.");
+    cacheFileName.append(std::to_string(mode));
+    cacheFileName.append(".");
+    cacheFileName.append(typeid(T).name());
+    cacheFileName.append(".v");
+    cacheFileName.append(std::to_string(INDEX_CACHE_VERSION));
+    return cacheFileName;
+}
+
+template<typename T>
+void readIndexId(T *, char *, char **) { }
+
+template<>
+void readIndexId(int32_t *id, char *line, char **save) {
+    *id = static_cast<int32_t>(strtol(strtok_r(line, "\t", save), NULL, 10));
+}
+
+template<>
+void readIndexId(char (*id)[32], char *line, char **save) {
+    // keys are stored zero padded to compare them as fixed width blocks
+    const char *identifier = strtok_r(line, "\t", save);
+    size_t length = strlen(identifier);
+    if (length > 32) {
+        // a truncated key could match the one of another entry
+        std::ostringstream message;
+        message << "Key " << identifier << " is longer than 32 bytes";
+        throw std::runtime_error(message.str());
+    }
+    memset(*id, 0, 32);
+    memcpy(*id, identifier, length);
+}
+
+template<typename T>
+void readIndexFile(const std::string &indexFileName, bool withOffsets, IndexEntry<T> *index, size_t size) {
+    std::ifstream indexFile(indexFileName);
+
+    if (indexFile.fail()) {
+        std::ostringstream message;
+        message << "Could not open index file " << indexFileName;
+        throw std::runtime_error(message.str());
+    }
+
+    char *save;
+    size_t i = 0;
+    std::string line;
+    while (std::getline(indexFile, line)) {
+        if (i >= size) {
+            std::ostringstream message;
+            message << "Could not read index entry in line " << i;
+            throw std::runtime_error(message.str());
+        }
+
+        char *l = (char *) line.c_str();
+        readIndexId<T>(&index[i].id, l, &save);
+        size_t offset = strtoull(strtok_r(NULL, "\t", &save), NULL, 10);
+        size_t length = strtoull(strtok_r(NULL, "\t", &save), NULL, 10);
+
+        index[i].length = length;
+
+        if (withOffsets) {
+            index[i].offset = offset;
+        } else {
+            index[i].offset = 0;
+        }
+
+        i++;
+    }
+
+    indexFile.close();
+}
+
+template<typename T>
+void sortIndexEntries(IndexEntry<T> *index, size_t size) {
+    std::stable_sort(index, index + size, [](const IndexEntry<T> &lhs, const IndexEntry<T> &rhs) {
+        return KeyCompare<T>::less(lhs.id, rhs.id);
+    });
+}
+
+template<typename T>
+uint64_t hashIndex(const IndexEntry<T> *index, size_t size) {
+    // the padding of the entries is not initialized, so only the fields are hashed
+    uint64_t h = mixHash(static_cast<uint64_t>(size));
+    for (size_t i = 0; i < size; i++) {
+        h = mixHash(h ^ hashKey<T>(index[i].id));
+        h = mixHash(h ^ static_cast<uint64_t>(index[i].offset));
+        h = mixHash(h ^ static_cast<uint64_t>(index[i].length));
+    }
+    return h;
+}
+
+template<typename T>
+uint64_t saveIndexCache(const std::string &fileName, const IndexEntry<T> *index, size_t size) {
+    IndexCacheHeader header;
+    memset(&header, 0, sizeof(IndexCacheHeader));
+    header.magic = IndexCacheHeader::MAGIC;
+    header.entrySize = sizeof(IndexEntry<T>);
+    header.entries = size;
+    header.contentHash = hashIndex<T>(index, size);
+
+    writeFileAtomically(fileName, {{&header, sizeof(IndexCacheHeader)}, {index, size * sizeof(IndexEntry<T>)}});
+    return header.contentHash;
+}
+
+template<typename T>
+IndexEntry<T> *mapIndexCache(const std::string &fileName, size_t *size, uint64_t *contentHash) {
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fileno(file), &sb) != 0 || static_cast<size_t>(sb.st_size) < sizeof(IndexCacheHeader)) {
+        fclose(file);
+        return NULL;
+    }
+
+    ssize_t fileSize;
+    char *map = mmapData(file, &fileSize, false);
+    fclose(file);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const IndexCacheHeader *header = (const IndexCacheHeader *) map;
+    if (header->magic != IndexCacheHeader::MAGIC || header->entrySize != sizeof(IndexEntry<T>)
+        || sizeof(IndexCacheHeader) + header->entries * sizeof(IndexEntry<T>) != static_cast<size_t>(fileSize)) {
+        munmap(map, static_cast<size_t>(fileSize));
+        return NULL;
+    }
+
+    *size = static_cast<size_t>(header->entries);
+    *contentHash = header->contentHash;
+    return (IndexEntry<T> *) (map + sizeof(IndexCacheHeader));
+}
+
+template<typename T>
+void unmapIndexCache(IndexEntry<T> *index, size_t size) {
+    munmap(reinterpret_cast<char *>(index) - sizeof(IndexCacheHeader),
+           sizeof(IndexCacheHeader) + size * sizeof(IndexEntry<T>));
+}
+
+template<typename T>
+void buildIndexFilter(BlockedBloomFilter &filter, const IndexEntry<T> *index, size_t size) {
+    filter.init(size);
+    for (size_t i = 0; i < size; i++) {
+        filter.add(hashKey<T>(index[i].id));
+    }
+}
+
+void saveIndexFilter(const std::string &fileName, const BlockedBloomFilter &filter, uint64_t identity) {
+    BlockedBloomFilter::FileHeader header;
+    memset(&header, 0, sizeof(BlockedBloomFilter::FileHeader));
+    header.magic = BlockedBloomFilter::FileHeader::MAGIC;
+    header.entries = filter.entries();
+    header.blocks = filter.blockCount();
+    header.identity = identity;
+
+    writeFileAtomically(fileName, {{&header, sizeof(BlockedBloomFilter::FileHeader)}, {filter.data(), filter.byteSize()}});
+}
+
+template<typename T>
+void verifyIndex(const IndexEntry<T> *index, size_t size, const char *data, size_t dataSize) {
+    for (size_t i = 0; i < size; i++) {
+        const IndexEntry<T> &entry = index[i];
+        if (entry.length == 0 || entry.offset > dataSize || entry.length > dataSize - entry.offset) {
+            std::ostringstream message;
+            message << "Index entry " << i << " at offset " << entry.offset << " with length " << entry.length
+                    << " is outside of the data";
+            throw std::runtime_error(message.str());
+        }
+
+        if (data[entry.offset + entry.length - 1] != '\0') {
+            std::ostringstream message;
+            message << "Index entry " << i << " at offset " << entry.offset << " is not null terminated";
+            throw std::runtime_error(message.str());
+        }
+    }
+}
+
+template std::string indexCacheFileName<int32_t>(const std::string &, int);
+template void readIndexFile<int32_t>(const std::string &, bool, IndexEntry<int32_t> *, size_t);
+template void sortIndexEntries<int32_t>(IndexEntry<int32_t> *, size_t);
+template uint64_t hashIndex<int32_t>(const IndexEntry<int32_t> *, size_t);
+template uint64_t saveIndexCache<int32_t>(const std::string &, const IndexEntry<int32_t> *, size_t);
+template IndexEntry<int32_t> *mapIndexCache<int32_t>(const std::string &, size_t *, uint64_t *);
+template void unmapIndexCache<int32_t>(IndexEntry<int32_t> *, size_t);
+template void buildIndexFilter<int32_t>(BlockedBloomFilter &, const IndexEntry<int32_t> *, size_t);
+template void verifyIndex<int32_t>(const IndexEntry<int32_t> *, size_t, const char *, size_t);
+
+template std::string indexCacheFileName<char[32]>(const std::string &, int);
+template void readIndexFile<char[32]>(const std::string &, bool, IndexEntry<char[32]> *, size_t);
+template void sortIndexEntries<char[32]>(IndexEntry<char[32]> *, size_t);
+template uint64_t hashIndex<char[32]>(const IndexEntry<char[32]> *, size_t);
+template uint64_t saveIndexCache<char[32]>(const std::string &, const IndexEntry<char[32]> *, size_t);
+template IndexEntry<char[32]> *mapIndexCache<char[32]>(const std::string &, size_t *, uint64_t *);
+template void unmapIndexCache<char[32]>(IndexEntry<char[32]> *, size_t);
+template void buildIndexFilter<char[32]>(BlockedBloomFilter &, const IndexEntry<char[32]> *, size_t);
+template void verifyIndex<char[32]>(const IndexEntry<char[32]> *, size_t, const char *, size_t);
@@ -0,0 +1,91 @@
+#ifndef DBINDEX_H
+#define DBINDEX_H
+
+// Parsing, sorting and caching of ffindex indices without any PHP dependency,
+// shared by DBReader and the dbreader_cache tool that prebuilds caches offline.
+// Errors are reported as std::runtime_error.
+//
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "BloomFilter.h"
+
+// the cache file is an IndexCacheHeader followed by these entries sorted by id
+template<typename T>
+struct IndexEntry {
+    T id;
+    size_t length;
+    size_t offset;
+};
+
+// part of the cache file names, increased whenever the cache layout or key encoding changes
+const int INDEX_CACHE_VERSION = 3;
+
+struct IndexCacheHeader {
+    static const uint64_t MAGIC = 0x484341434442ULL;
+
+    uint64_t magic;
+    uint64_t entrySize;
+    uint64_t entries;
+    // hash over all entries, ties the key filter to the cache and stays the same when the DB is copied
+    uint64_t contentHash;
+};
+
+bool fileExists(const std::string& name);
+
+struct FilePart {
+    const void *data;
+    size_t bytes;
+};
+
+// writes the parts to a temporary file that is renamed to fileName,
+// so concurrent readers only ever see a complete file
+void writeFileAtomically(const std::string &fileName, const std::vector<FilePart> &parts);
+
+size_t countLines(const std::string& name);
+
+char *mmapData(FILE *file, ssize_t *dataSize, bool writable);
+
+// mode must only contain flags that change what the index contains
+template<typename T>
+std::string indexCacheFileName(const std::string &indexFileName, int mode);
+
+// reads size lines of the index, offsets are set to zero unless withOffsets is set
+template<typename T>
+void readIndexFile(const std::string &indexFileName, bool withOffsets, IndexEntry<T> *index, size_t size);
+
+template<typename T>
+void sortIndexEntries(IndexEntry<T> *index, size_t size);
+
+template<typename T>
+uint64_t hashIndex(const IndexEntry<T> *index, size_t size);
+
+// returns the contentHash of the written cache
+template<typename T>
+uint64_t saveIndexCache(const std::string &fileName, const IndexEntry<T> *index, size_t size);
+
+// returns NULL if the cache is missing or was not written by saveIndexCache for this key type
+template<typename T>
+IndexEntry<T> *mapIndexCache(const std::string &fileName, size_t *size, uint64_t *contentHash);
+
+template<typename T>
+void unmapIndexCache(IndexEntry<T> *index, size_t size);
+
+template<typename T>
+void buildIndexFilter(BlockedBloomFilter &filter, const IndexEntry<T> *index, size_t size);
+
+// identity has to be passed to BlockedBloomFilter::load again to map the filter
+void saveIndexFilter(const std::string &fileName, const BlockedBloomFilter &filter, uint64_t identity);
+
+// checks that every entry lies within the data and ends with the null byte of the ffindex format
+template<typename T>
+void verifyIndex(const IndexEntry<T> *index, size_t size, const char *data, size_t dataSize);
+
+#endif
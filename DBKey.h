@@ -0,0 +1,98 @@
+#ifndef DBKEY_H
+#define DBKEY_H
+
+// Comparison, hashing and conversion of the integer and fixed width string
+// keys of an ffindex, shared by all readers.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+template<typename T>
+struct KeyCompare {
+    static bool less(const T &x, const T &y) {
+        return x < y;
+    }
+
+    static bool equal(const T &x, const T &y) {
+        return x == y;
+    }
+};
+
+// compares zero padded keys of N bytes, which orders them like strcmp on the unpadded strings
+template<size_t N>
+struct FixedWidthKey {
+    static int compare(const char *x, const char *y) {
+#ifdef __SSE2__
+        if (N % 16 == 0) {
+            for (size_t i = 0; i < N; i += 16) {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i));
+                unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) ^ 0xFFFFu;
+                if (mask != 0) {
+                    size_t j = i + __builtin_ctz(mask);
+                    return static_cast<unsigned char>(x[j]) - static_cast<unsigned char>(y[j]);
+                }
+            }
+            return 0;
+        }
+#endif
+        return memcmp(x, y, N);
+    }
+};
+
+template<size_t N>
+struct KeyCompare<char[N]> {
+    static bool less(const char (&x)[N], const char (&y)[N]) {
+        return FixedWidthKey<N>::compare(x, y) < 0;
+    }
+
+    static bool equal(const char (&x)[N], const char (&y)[N]) {
+        return FixedWidthKey<N>::compare(x, y) == 0;
+    }
+};
+
+// 64 bit finalizer of MurmurHash3
+inline uint64_t mixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// FNV-1a, stable across compilers and standard libraries, so it can be part of file and segment names
+inline uint64_t hashBytes(const char *data, size_t length) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+template<typename T>
+inline uint64_t hashKey(const T &key) {
+    return mixHash(static_cast<uint64_t>(key));
+}
+
+template<>
+inline uint64_t hashKey(const char (&key)[32]) {
+    // keys are zero padded, so all words can be hashed without looking for the end
+    uint64_t h = 0;
+    for (size_t i = 0; i < 32; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, key + i, sizeof(uint64_t));
+        h = mixHash(h ^ word);
+    }
+    return h;
+}
+
+#endif
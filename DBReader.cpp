@@ -1,53 +1,42 @@
 #include "DBReader.h"
+#include "RecordParser.h"
+#include "DBKey.h"
+#include "LookupIndex.h"
+#include "EntryStream.h"
 
 #include <sstream>
-#include <fstream>
+#include <stdexcept>
 #include <algorithm>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <cerrno>
+#include <stdint.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
-bool fileExists(const std::string& name) {
-    struct stat st;
-    return stat(name.c_str(), &st) == 0;
-}
-
-size_t countLines(const std::string& name) {
-    std::ifstream index(name);
-    if (index.fail()) {
-        std::ostringstream message;
-        message << "Could not open file " << name;
-        throw Php::Exception(message.str());
-    }
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
-    size_t cnt = 0;
-    std::vector<char> buffer(1024 * 1024);
-    index.read(buffer.data(), buffer.size());
-    while (ptrdiff_t r = index.gcount()) {
-        for (size_t i = 0; i < r; i++) {
-            const char *p = buffer.data();
-            if (p[i] == '\n') {
-                cnt++;
-            }
+bool preadFully(int fd, char *buffer, size_t length, size_t offset) {
+    while (length > 0) {
+        ssize_t r = pread(fd, buffer, length, static_cast<off_t>(offset));
+        if (r < 0 && errno == EINTR) {
+            continue;
         }
-        index.read(buffer.data(), buffer.size());
-    }
-    index.close();
-
-    return cnt;
-}
-
-char *mmapData(FILE *file, ssize_t *dataSize, bool writable) {
-    struct stat sb;
-    fstat(fileno(file), &sb);
-    *dataSize = sb.st_size;
-
-    int fd = fileno(file);
-    int mode = PROT_READ;
-    if (writable) {
-        mode |= PROT_WRITE;
+        if (r <= 0) {
+            return false;
+        }
+        buffer += r;
+        length -= static_cast<size_t>(r);
+        offset += static_cast<size_t>(r);
     }
-    return static_cast<char *>(mmap(NULL, static_cast<size_t>(*dataSize), mode, MAP_PRIVATE, fd, 0));
+    return true;
 }
 
 
@@ -57,15 +46,20 @@ void DBReader<T>::__construct(Php::Parameters &params) {
         throw Php::Exception("Not enough parameters");
     }
 
-    dataFileName = (const char *) params[0];
-    indexFileName = (const char *) params[1];
-
-    if (params.size() == 2) {
-        dataMode = USE_DATA;
-    } else {
-        dataMode = (int32_t) params[2];
+    int mode = USE_DATA;
+    if (params.size() > 2) {
+        mode = (int32_t) params[2];
     }
 
+    openDatabase((const char *) params[0], (const char *) params[1], mode);
+}
+
+template<typename T>
+void DBReader<T>::openDatabase(const std::string &dataFileName, const std::string &indexFileName, int dataMode) {
+    this->dataFileName = dataFileName;
+    this->indexFileName = indexFileName;
+    this->dataMode = dataMode;
+
     if (dataMode & USE_DATA) {
         dataFile = fopen(dataFileName.c_str(), "r");
         if (dataFile == NULL) {
@@ -73,70 +67,323 @@ void DBReader<T>::__construct(Php::Parameters &params) {
             message << "Could not open data file " << dataFileName;
             throw Php::Exception(message.str());
         }
-        bool writable = static_cast<bool>(dataMode & USE_WRITABLE);
-        data = mmapData(dataFile, &dataSize, writable);
+
+        ring = NULL;
+        if (dataMode & USE_PREAD) {
+            struct stat sb;
+            fstat(fileno(dataFile), &sb);
+            dataSize = sb.st_size;
+            data = NULL;
+#ifdef HAVE_LIBURING
+            // without a ring batches fall back to one pread per entry
+            ring = new struct io_uring;
+            if (io_uring_queue_init(IO_QUEUE_DEPTH, ring, 0) != 0) {
+                delete ring;
+                ring = NULL;
+            }
+#endif
+        } else {
+            bool writable = static_cast<bool>(dataMode & USE_WRITABLE);
+            data = mmapData(dataFile, &dataSize, writable);
+        }
     }
 
-    std::string cacheFileName = indexFileName;
-    cacheFileName.append(".cache.");
-    cacheFileName.append(std::to_string(dataMode));
-    cacheFileName.append(".");
-    cacheFileName.append(typeid(T).name());
+    // USE_SHARED and USE_PREAD only change how the index and data are accessed, not what the index contains
+    std::string cacheFileName = indexCacheFileName<T>(indexFileName, dataMode & ~(USE_SHARED | USE_PREAD));
 
-    if (fileExists(cacheFileName)) {
-        loadCache(cacheFileName);
-        loadedFromCache = true;
-        return;
+    sharedSegment = NULL;
+    sharedSegmentSize = 0;
+    if (dataMode & USE_SHARED) {
+        attachShared(cacheFileName);
+    } else {
+        loadIndex(cacheFileName);
     }
+}
 
-    size = countLines(indexFileName);
-    index = new Index[size];
-    readIndex();
-    sortIndex();
+template<typename T>
+void DBReader<T>::loadIndex(const std::string &cacheFileName) {
+    // a cache in an old layout or for another key type is rebuilt
+    if (loadCache(cacheFileName)) {
+        loadedFromCache = true;
+    } else {
+        try {
+            size = countLines(indexFileName);
+            index = new Index[size];
+            loadedFromCache = false;
+            readIndexFile<T>(indexFileName, dataMode & USE_DATA, index, static_cast<size_t>(size));
+            sortIndexEntries<T>(index, static_cast<size_t>(size));
+            cacheIdentity = saveIndexCache<T>(cacheFileName, index, static_cast<size_t>(size));
+        } catch (const std::runtime_error &e) {
+            throw Php::Exception(e.what());
+        }
+    }
 
-    saveCache(cacheFileName);
-    loadedFromCache = false;
+    loadFilter(cacheFileName);
 }
 
 template<typename T>
 void DBReader<T>::__destruct() {
+    closeDatabase();
+}
+
+template<typename T>
+void DBReader<T>::closeDatabase() {
+    lookup.close();
+    lineIndex.clear();
+
     if (dataMode & USE_DATA) {
-        munmap(data, static_cast<size_t>(dataSize));
+        if (dataMode & USE_PREAD) {
+#ifdef HAVE_LIBURING
+            if (ring != NULL) {
+                io_uring_queue_exit(ring);
+                delete ring;
+                ring = NULL;
+            }
+#endif
+        } else {
+            munmap(data, static_cast<size_t>(dataSize));
+        }
         fclose(dataFile);
     }
 
-    if (loadedFromCache) {
-        munmap(index, static_cast<size_t>(size));
+    releaseIndex();
+}
+
+template<typename T>
+void DBReader<T>::releaseIndex() {
+    if (sharedSegment != NULL) {
+        munmap(sharedSegment, sharedSegmentSize);
+        sharedSegment = NULL;
+    } else if (loadedFromCache) {
+        unmapIndexCache<T>(index, static_cast<size_t>(size));
     } else {
         delete[] index;
     }
+    index = NULL;
 }
 
 template<typename T>
-void DBReader<T>::loadCache(std::string fileName) {
-    FILE *file = fopen(fileName.c_str(), "rb");
-    if (file != NULL) {
-        index = (Index *) mmapData(file, &size, true);
-        size /= sizeof(Index);
-        fclose(file);
-    } else {
+bool DBReader<T>::loadCache(const std::string &fileName) {
+    size_t entries;
+    index = mapIndexCache<T>(fileName, &entries, &cacheIdentity);
+    if (index == NULL) {
+        return false;
+    }
+    size = static_cast<ssize_t>(entries);
+    return true;
+}
+
+struct SharedIndexHeader {
+    static const uint64_t MAGIC = 0x584449424450ULL;
+
+    uint64_t magic;
+    uint64_t entrySize;
+    uint64_t entries;
+    uint64_t filterBytes;
+    // identifies the index file the segment was built from
+    uint64_t indexFileSize;
+    int64_t indexModified;
+    uint64_t padding[2];
+};
+
+// returns an empty name if the index file cannot be resolved
+std::string sharedSegmentName(const std::string &indexFileName, const std::string &cacheFileName) {
+    // shared memory names may not contain slashes, so the absolute path is hashed.
+    // the cache might not exist yet, so the index is resolved and the cache suffix
+    // (mode, key type and version) appended
+    char *resolved = realpath(indexFileName.c_str(), NULL);
+    if (resolved == NULL) {
+        return std::string();
+    }
+    std::string path = resolved;
+    free(resolved);
+    path.append(cacheFileName, indexFileName.size(), std::string::npos);
+
+    uint64_t h = hashBytes(path.data(), path.size());
+
+    char name[32];
+    snprintf(name, sizeof(name), "/dbreader.%016llx", static_cast<unsigned long long>(h));
+    return name;
+}
+
+template<typename T>
+bool DBReader<T>::mapShared(const std::string &segmentName, const struct stat &indexStat) {
+    int fd = shm_open(segmentName.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || static_cast<size_t>(sb.st_size) < sizeof(SharedIndexHeader)) {
+        close(fd);
+        return false;
+    }
+
+    size_t segmentSize = static_cast<size_t>(sb.st_size);
+    void *segment = mmap(NULL, segmentSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        return false;
+    }
+
+    const SharedIndexHeader *header = static_cast<const SharedIndexHeader *>(segment);
+    if (header->magic != SharedIndexHeader::MAGIC
+        || header->entrySize != sizeof(Index)
+        || header->indexFileSize != static_cast<uint64_t>(indexStat.st_size)
+        || header->indexModified != static_cast<int64_t>(indexStat.st_mtime)
+        || sizeof(SharedIndexHeader) + header->entries * sizeof(Index) + header->filterBytes != segmentSize) {
+        munmap(segment, segmentSize);
+        return false;
+    }
+
+    sharedSegment = segment;
+    sharedSegmentSize = segmentSize;
+    size = static_cast<ssize_t>(header->entries);
+    index = (Index *) (static_cast<char *>(segment) + sizeof(SharedIndexHeader));
+    filter.attach((const uint64_t *) (index + size), header->filterBytes);
+    return true;
+}
+
+template<typename T>
+void DBReader<T>::createShared(const std::string &segmentName, const std::string &cacheFileName,
+                               const struct stat &indexStat) {
+    loadIndex(cacheFileName);
+
+    SharedIndexHeader header;
+    memset(&header, 0, sizeof(SharedIndexHeader));
+    header.magic = SharedIndexHeader::MAGIC;
+    header.entrySize = sizeof(Index);
+    header.entries = static_cast<uint64_t>(size);
+    header.filterBytes = filter.byteSize();
+    header.indexFileSize = static_cast<uint64_t>(indexStat.st_size);
+    header.indexModified = static_cast<int64_t>(indexStat.st_mtime);
+    size_t indexBytes = static_cast<size_t>(size) * sizeof(Index);
+    size_t segmentSize = sizeof(SharedIndexHeader) + indexBytes + header.filterBytes;
+
+    // processes that still use an outdated segment keep their mapping
+    shm_unlink(segmentName.c_str());
+    int fd = shm_open(segmentName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        std::ostringstream message;
+        message << "Could not create shared index " << segmentName;
+        throw Php::Exception(message.str());
+    }
+
+    void *segment = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(segmentSize)) == 0) {
+        segment = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (segment == MAP_FAILED) {
+        shm_unlink(segmentName.c_str());
         std::ostringstream message;
-        message << "Could not load index cache from " << fileName;
+        message << "Could not allocate shared index " << segmentName;
         throw Php::Exception(message.str());
     }
+
+    char *pos = static_cast<char *>(segment);
+    memcpy(pos + sizeof(SharedIndexHeader), index, indexBytes);
+    memcpy(pos + sizeof(SharedIndexHeader) + indexBytes, filter.data(), header.filterBytes);
+    // the header is written last, a segment without it is never attached
+    memcpy(pos, &header, sizeof(SharedIndexHeader));
+    munmap(segment, segmentSize);
+
+    releaseIndex();
 }
 
 template<typename T>
-void DBReader<T>::saveCache(std::string fileName) {
-    FILE *file = fopen(fileName.c_str(), "w+b");
-    if (file != NULL) {
-        fwrite(index, sizeof(Index), static_cast<size_t>(size), file);
-        fclose(file);
-    } else {
+void DBReader<T>::attachShared(const std::string &cacheFileName) {
+    struct stat indexStat;
+    if (stat(indexFileName.c_str(), &indexStat) != 0) {
+        std::ostringstream message;
+        message << "Could not open index file " << indexFileName;
+        throw Php::Exception(message.str());
+    }
+
+    std::string segmentName = sharedSegmentName(indexFileName, cacheFileName);
+    if (segmentName.empty()) {
         std::ostringstream message;
-        message << "Could not save index cache to " << fileName;
+        message << "Could not resolve index file " << indexFileName;
         throw Php::Exception(message.str());
     }
+
+    std::string lockFileName = cacheFileName + ".lock";
+    int lock = open(lockFileName.c_str(), O_RDWR | O_CREAT, 0666);
+    if (lock == -1) {
+        std::ostringstream message;
+        message << "Could not open lock file " << lockFileName;
+        throw Php::Exception(message.str());
+    }
+
+    // readers hold a shared lock, only the first opener takes the exclusive lock and builds the segment
+    bool attached = false;
+    if (flock(lock, LOCK_SH) == 0) {
+        attached = mapShared(segmentName, indexStat);
+        flock(lock, LOCK_UN);
+    }
+
+    if (!attached) {
+        if (flock(lock, LOCK_EX) != 0) {
+            close(lock);
+            std::ostringstream message;
+            message << "Could not lock " << lockFileName;
+            throw Php::Exception(message.str());
+        }
+
+        try {
+            if (!mapShared(segmentName, indexStat)) {
+                createShared(segmentName, cacheFileName, indexStat);
+                attached = mapShared(segmentName, indexStat);
+            } else {
+                attached = true;
+            }
+        } catch (...) {
+            flock(lock, LOCK_UN);
+            close(lock);
+            throw;
+        }
+        flock(lock, LOCK_UN);
+    }
+    close(lock);
+
+    if (!attached) {
+        std::ostringstream message;
+        message << "Could not attach shared index " << segmentName;
+        throw Php::Exception(message.str());
+    }
+    loadedFromCache = true;
+}
+
+template<typename T>
+void DBReader<T>::loadFilter(const std::string &cacheFileName) {
+    // a filter that was built for another version of the cache would reject keys that exist
+    std::string fileName = cacheFileName + ".filter";
+    if (loadedFromCache && filter.load(fileName, static_cast<size_t>(size), cacheIdentity)) {
+        return;
+    }
+
+    // the directory might be read-only, then the filter is rebuilt by every reader but still used
+    buildIndexFilter<T>(filter, index, static_cast<size_t>(size));
+    try {
+        saveIndexFilter(fileName, filter, cacheIdentity);
+    } catch (const std::runtime_error &) {
+    }
+}
+
+template<typename T>
+int64_t DBReader<T>::findId(const Index &key) {
+    if (!filter.mayContain(hashKey<T>(key.id))) {
+        return -1;
+    }
+
+    const Index *entry = std::lower_bound(index, index + size, key, [](const Index &x, const Index &y) {
+        return KeyCompare<T>::less(x.id, y.id);
+    });
+
+    if (entry != index + size && KeyCompare<T>::equal(entry->id, key.id)) {
+        return static_cast<int64_t>(entry - index);
+    }
+    return -1;
 }
 
 template<typename T>
@@ -145,40 +392,154 @@ Php::Value DBReader<T>::getId(Php::Parameters &params) {
         throw Php::Exception("Not enough parameters");
     }
 
-    T dbKey = params[0];
-
     Index val;
-    val.id = dbKey;
-    size_t id = std::upper_bound(index, index + size, val, compareById) - index;
+    int64_t id = readParameterKey<T>(&val.id, params[0]) ? findId(val) : -1;
 
-    if (id < size && index[id].id == dbKey) {
-        return (int64_t) id;
+    if (id != -1) {
+        return id;
     } else {
         std::ostringstream message;
-        message << "Key " << id << " not found in index";
+        message << "Key " << params[0].stringValue() << " not found in index";
         throw Php::Exception(message.str());
     }
 }
 
-template<>
-Php::Value DBReader<char[32]>::getId(Php::Parameters &params) {
+template<typename T>
+const size_t DBReader<T>::LOOKUP_BATCH_SIZE;
+
+template<typename T>
+const unsigned DBReader<T>::IO_QUEUE_DEPTH;
+
+// branchless lower bound searches for up to LOOKUP_BATCH_SIZE keys in lockstep,
+// so the cache misses of the independent searches overlap
+template<typename T>
+void DBReader<T>::lookupBatch(const Index *keys, size_t count, int64_t *ids) {
+    if (size <= 0) {
+        std::fill(ids, ids + count, -1);
+        return;
+    }
+
+    const Index *base[LOOKUP_BATCH_SIZE];
+    size_t n = static_cast<size_t>(size);
+    for (size_t k = 0; k < count; k++) {
+        base[k] = index;
+        __builtin_prefetch(base[k] + n / 2);
+    }
+
+    while (n > 1) {
+        size_t half = n / 2;
+        for (size_t k = 0; k < count; k++) {
+            base[k] = KeyCompare<T>::less(base[k][half].id, keys[k].id) ? base[k] + half : base[k];
+        }
+        n -= half;
+        for (size_t k = 0; k < count; k++) {
+            __builtin_prefetch(base[k] + n / 2);
+        }
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        const Index *entry = base[k] + KeyCompare<T>::less(base[k]->id, keys[k].id);
+        size_t id = static_cast<size_t>(entry - index);
+        if (id < static_cast<size_t>(size) && KeyCompare<T>::equal(entry->id, keys[k].id)) {
+            ids[k] = static_cast<int64_t>(id);
+        } else {
+            ids[k] = -1;
+        }
+    }
+}
+
+template<typename T>
+Php::Value DBReader<T>::getIds(Php::Parameters &params) {
     if (params.size() < 1) {
         throw Php::Exception("Not enough parameters");
     }
 
-    Index val;
-    memcpy(&val.id, static_cast<const char *>(params[0]), 32);
+    if (!params[0].isArray()) {
+        throw Php::Exception("Expected an array of keys");
+    }
+
+    // keys that can not be in the index or are rejected by the filter never reach the binary search
+    std::vector<Index> keys(static_cast<size_t>(params[0].size()));
+    std::vector<size_t> candidates;
+    candidates.reserve(keys.size());
+    size_t count = 0;
+    for (auto &iter : params[0]) {
+        if (readParameterKey<T>(&keys[count].id, iter.second) && filter.mayContain(hashKey<T>(keys[count].id))) {
+            candidates.push_back(count);
+        }
+        count++;
+    }
+    std::vector<int64_t> ids(count, -1);
+
+    Index batch[LOOKUP_BATCH_SIZE];
+    int64_t batchIds[LOOKUP_BATCH_SIZE];
+    for (size_t i = 0; i < candidates.size(); i += LOOKUP_BATCH_SIZE) {
+        size_t batchSize = std::min(LOOKUP_BATCH_SIZE, candidates.size() - i);
+        for (size_t k = 0; k < batchSize; k++) {
+            batch[k] = keys[candidates[i + k]];
+        }
+        lookupBatch(batch, batchSize, batchIds);
+        for (size_t k = 0; k < batchSize; k++) {
+            ids[candidates[i + k]] = batchIds[k];
+        }
+    }
+
+    Php::Array result;
+    for (size_t i = 0; i < count; i++) {
+        result[static_cast<int>(i)] = ids[i];
+    }
+    return result;
+}
+
+template<typename T>
+void DBReader<T>::openLookup(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    try {
+        lookup.open(params[0].stringValue());
+    } catch (const std::runtime_error &e) {
+        throw Php::Exception(e.what());
+    }
+}
+
+template<typename T>
+Php::Value DBReader<T>::getLookupKey(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
 
-    size_t id = std::upper_bound(index, index + size, val,
-                                 [](const Index &x, const Index &y) {
-                                     return strcmp(x.id, y.id) <= 0;
-                                 }) - index;
+    if (!lookup.isOpen()) {
+        throw Php::Exception("No lookup file opened");
+    }
 
-    if (id < size && strcmp(index[id].id, val.id) == 0) {
-        return (int64_t) id;
+    std::string accession = params[0].stringValue();
+    int32_t key;
+    if (!lookup.find(accession.c_str(), accession.size(), &key)) {
+        std::ostringstream message;
+        message << "Accession " << accession << " not found in lookup";
+        throw Php::Exception(message.str());
+    }
+    return key;
+}
+
+template<typename T>
+Php::Value DBReader<T>::getIdByAccession(Php::Parameters &) {
+    throw Php::Exception("Accession lookups need a DBReader with integer keys");
+}
+
+template<>
+Php::Value DBReader<int32_t>::getIdByAccession(Php::Parameters &params) {
+    Index val;
+    val.id = getLookupKey(params);
+    int64_t id = findId(val);
+
+    if (id != -1) {
+        return id;
     } else {
         std::ostringstream message;
-        message << "Key " << id << " not found in index";
+        message << "Key " << val.id << " not found in index";
         throw Php::Exception(message.str());
     }
 }
@@ -201,115 +562,478 @@ Php::Value DBReader<T>::getDbKey(Php::Parameters &params) {
 
     checkBounds(id, static_cast<size_t>(size));
 
-    return index[id].id;
+    return keyValue<T>(index[id].id);
 }
 
 template<typename T>
-Php::Value DBReader<T>::getData(Php::Parameters &params) {
-    if (params.size() < 1) {
-        throw Php::Exception("Not enough parameters");
+const char *DBReader<T>::readData(size_t offset, size_t length) {
+    // the buffer is reused for every read and always null terminated like the mmapped entries
+    readBuffer.resize(length + 1);
+    if (!preadFully(fileno(dataFile), readBuffer.data(), length, offset)) {
+        std::ostringstream message;
+        message << "Could not read from data file " << dataFileName;
+        throw Php::Exception(message.str());
     }
+    readBuffer[length] = '\0';
+    return readBuffer.data();
+}
 
+template<typename T>
+const char *DBReader<T>::getEntryRange(size_t id, size_t start, size_t count, size_t *length) {
     if (!(dataMode & USE_DATA)) {
         throw Php::Exception("DBReader is not open in USE_DATA mode");
     }
 
-    size_t id = static_cast<size_t>((int64_t) params[0]);
-
     checkBounds(id, static_cast<size_t>(size));
 
-    if ((size_t) (index[id].offset) >= dataSize) {
+    if ((size_t) (index[id].offset) >= dataSize || index[id].length == 0
+        || index[id].offset + index[id].length > static_cast<size_t>(dataSize)) {
         throw Php::Exception("Invalid database read");
     }
 
-    const char* dataPos = (data + index[id].offset);
-    return Php::Value(dataPos, static_cast<int>(index[id].length - 1));
+    // entries are always terminated by a null byte
+    *length = index[id].length - 1;
+    start = std::min(start, *length);
+    count = std::min(count, *length - start);
+
+    if (dataMode & USE_PREAD) {
+        return readData(index[id].offset + start, count);
+    }
+    return data + index[id].offset + start;
 }
 
 template<typename T>
-Php::Value DBReader<T>::getLength(Php::Parameters &params) {
+const char *DBReader<T>::getEntry(size_t id, size_t *length) {
+    return getEntryRange(id, 0, SIZE_MAX, length);
+}
+
+template<typename T>
+Php::Value DBReader<T>::getData(Php::Parameters &params) {
     if (params.size() < 1) {
         throw Php::Exception("Not enough parameters");
     }
 
     size_t id = static_cast<size_t>((int64_t) params[0]);
 
-    checkBounds(id, static_cast<size_t>(size));
+    size_t length;
+    const char *dataPos = getEntry(id, &length);
+    return Php::Value(dataPos, static_cast<int>(length));
+}
 
-    return (int64_t) index[id].length;
+template<typename T>
+Php::Value DBReader<T>::getDataBatch(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    if (!params[0].isArray()) {
+        throw Php::Exception("Expected an array of ids");
+    }
+
+    std::vector<size_t> ids;
+    for (auto &iter : params[0]) {
+        ids.push_back(static_cast<size_t>((int64_t) iter.second));
+    }
+
+    Php::Array result;
+    if (!(dataMode & USE_PREAD)) {
+        for (size_t i = 0; i < ids.size(); i++) {
+            size_t length;
+            const char *dataPos = getEntry(ids[i], &length);
+            result[static_cast<int>(i)] = Php::Value(dataPos, static_cast<int>(length));
+        }
+        return result;
+    }
+
+    std::vector<size_t> positions(ids.size() + 1, 0);
+    for (size_t i = 0; i < ids.size(); i++) {
+        size_t length;
+        // validates the entry without reading it
+        getEntryRange(ids[i], 0, 0, &length);
+        positions[i + 1] = positions[i] + length;
+    }
+
+    std::vector<char> buffer(positions.back() + 1);
+    readEntries(ids, positions, buffer.data());
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        result[static_cast<int>(i)] = Php::Value(buffer.data() + positions[i],
+                                                 static_cast<int>(positions[i + 1] - positions[i]));
+    }
+    return result;
 }
 
 template<typename T>
-Php::Value DBReader<T>::getOffset(Php::Parameters &params) {
+void DBReader<T>::readEntries(const std::vector<size_t> &ids, const std::vector<size_t> &positions, char *buffer) {
+    int fd = fileno(dataFile);
+    // entries before first were already read through io_uring
+    size_t first = 0;
+
+#ifdef HAVE_LIBURING
+    if (ring != NULL) {
+        // keeps up to IO_QUEUE_DEPTH reads in flight so the device can serve them in parallel
+        size_t next = 0;
+        size_t inflight = 0;
+        // set when reads could not be submitted, the ring is then torn down once the submitted ones finished
+        bool failed = false;
+
+        // when a read fails the reads still in flight target buffer, which the caller frees while unwinding,
+        // and their completions would be taken for the ones of the next batch
+        struct InflightGuard {
+            struct io_uring *&ring;
+            size_t &inflight;
+            bool &failed;
+
+            ~InflightGuard() {
+                while (inflight > 0) {
+                    struct io_uring_cqe *cqe;
+                    int ret = io_uring_wait_cqe(ring, &cqe);
+                    if (ret == -EINTR) {
+                        continue;
+                    }
+                    if (ret < 0) {
+                        failed = true;
+                        break;
+                    }
+                    io_uring_cqe_seen(ring, cqe);
+                    inflight--;
+                }
+                // tearing down the ring waits for the remaining reads and drops unsubmitted ones,
+                // later batches use pread
+                if (failed) {
+                    io_uring_queue_exit(ring);
+                    delete ring;
+                    ring = NULL;
+                }
+            }
+        } guard = { ring, inflight, failed };
+        while (inflight > 0 || (!failed && next < ids.size())) {
+            size_t prepared = 0;
+            while (!failed && next < ids.size() && inflight < IO_QUEUE_DEPTH) {
+                struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+                if (sqe == NULL) {
+                    break;
+                }
+                io_uring_prep_read(sqe, fd, buffer + positions[next],
+                                   static_cast<unsigned>(positions[next + 1] - positions[next]),
+                                   index[ids[next]].offset);
+                io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(next));
+                next++;
+                inflight++;
+                prepared++;
+            }
+
+            if (prepared > 0) {
+                int submitted = io_uring_submit(ring);
+                size_t accepted = submitted > 0 ? static_cast<size_t>(submitted) : 0;
+                if (accepted < prepared) {
+                    // the reads that were not submitted are done with pread
+                    next -= prepared - accepted;
+                    inflight -= prepared - accepted;
+                    failed = true;
+                }
+            } else if (inflight == 0) {
+                // no free submission entry and nothing to wait for
+                failed = true;
+            }
+            if (inflight == 0) {
+                continue;
+            }
+
+            struct io_uring_cqe *cqe;
+            int ret = io_uring_wait_cqe(ring, &cqe);
+            if (ret == -EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                std::ostringstream message;
+                message << "Could not read from data file " << dataFileName;
+                throw Php::Exception(message.str());
+            }
+
+            size_t i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+            int res = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+            inflight--;
+
+            // short or failed reads are finished synchronously
+            size_t length = positions[i + 1] - positions[i];
+            size_t got = res > 0 ? static_cast<size_t>(res) : 0;
+            if (got < length
+                && !preadFully(fd, buffer + positions[i] + got, length - got, index[ids[i]].offset + got)) {
+                std::ostringstream message;
+                message << "Could not read from data file " << dataFileName;
+                throw Php::Exception(message.str());
+            }
+        }
+        if (!failed) {
+            return;
+        }
+        first = next;
+    }
+#endif
+
+    // read in file order to keep the access pattern as sequential as possible
+    std::vector<size_t> order(ids.size() - first);
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = first + i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+        return index[ids[x]].offset < index[ids[y]].offset;
+    });
+
+    for (size_t k = 0; k < order.size(); k++) {
+        size_t i = order[k];
+        if (!preadFully(fd, buffer + positions[i], positions[i + 1] - positions[i], index[ids[i]].offset)) {
+            std::ostringstream message;
+            message << "Could not read from data file " << dataFileName;
+            throw Php::Exception(message.str());
+        }
+    }
+}
+
+template<typename T>
+Php::Value DBReader<T>::getStream(Php::Parameters &params) {
     if (params.size() < 1) {
         throw Php::Exception("Not enough parameters");
     }
 
     size_t id = static_cast<size_t>((int64_t) params[0]);
 
-    checkBounds(id, static_cast<size_t>(size));
+    // validates the entry without reading it
+    size_t length;
+    getEntryRange(id, 0, 0, &length);
 
-    return static_cast<int64_t>(index[id].offset);
+    // the stream keeps this reader alive, so data stays mapped until the stream is closed
+    Php::Value self(this);
+    if (dataMode & USE_PREAD) {
+        return createEntryStream(NULL, fileno(dataFile), index[id].offset, length, self);
+    }
+    return createEntryStream(data + index[id].offset, -1, 0, length, self);
 }
 
 template<typename T>
-void readIndexId(T *, char *, char **) { }
+Php::Value DBReader<T>::getDataSlice(Php::Parameters &params) {
+    if (params.size() < 3) {
+        throw Php::Exception("Not enough parameters");
+    }
 
-template<>
-void readIndexId(int32_t *id, char *line, char **save) {
-    *id = static_cast<int32_t>(strtol(strtok_r(line, "\t", save), NULL, 10));
+    size_t id = static_cast<size_t>((int64_t) params[0]);
+    int64_t start = params[1];
+    int64_t sliceLength = params[2];
+    if (start < 0 || sliceLength < 0) {
+        throw Php::Exception("Invalid slice");
+    }
+
+    // only the requested range is read in USE_PREAD mode
+    size_t length;
+    const char *dataPos = getEntryRange(id, static_cast<size_t>(start), static_cast<size_t>(sliceLength), &length);
+    if (static_cast<size_t>(start) >= length) {
+        return Php::Value("", 0);
+    }
+
+    size_t available = length - static_cast<size_t>(start);
+    size_t len = std::min(available, static_cast<size_t>(sliceLength));
+    return Php::Value(dataPos, static_cast<int>(len));
 }
 
-template<>
-void readIndexId(char (*id)[32], char *line, char **save) {
-    const char *identifier = strtok_r(line, "\t", save);
-    memcpy(id, identifier, 32);
+template<typename T>
+const typename DBReader<T>::LineIndex &DBReader<T>::getLineIndex(size_t id, const char *entry, size_t length) {
+    auto it = lineIndex.find(id);
+    if (it != lineIndex.end()) {
+        return it->second;
+    }
+
+    if (lineIndex.size() >= LINE_INDEX_CACHE_SIZE) {
+        lineIndex.erase(lineIndex.begin());
+    }
+
+    LineIndex &lines = lineIndex[id];
+    lines.lines = 0;
+    const char *pos = entry;
+    const char *end = entry + length;
+    while (pos < end) {
+        if (lines.lines % LINE_INDEX_STRIDE == 0) {
+            lines.offsets.push_back(static_cast<size_t>(pos - entry));
+        }
+        lines.lines++;
+        const char *newline = static_cast<const char *>(memchr(pos, '\n', static_cast<size_t>(end - pos)));
+        if (newline == NULL) {
+            break;
+        }
+        pos = newline + 1;
+    }
+    return lines;
 }
 
 template<typename T>
-void DBReader<T>::readIndex() {
-    std::ifstream indexFile(indexFileName);
+Php::Value DBReader<T>::getDataLine(Php::Parameters &params) {
+    if (params.size() < 2) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    size_t id = static_cast<size_t>((int64_t) params[0]);
+    size_t lineNo = static_cast<size_t>((int64_t) params[1]);
 
-    if (indexFile.fail()) {
+    size_t length;
+    const char *entry = getEntry(id, &length);
+    const char *end = entry + length;
+
+    const char *line = NULL;
+    if (length > LINE_INDEX_THRESHOLD) {
+        const LineIndex &lines = getLineIndex(id, entry, length);
+        if (lineNo < lines.lines) {
+            line = entry + lines.offsets[lineNo / LINE_INDEX_STRIDE];
+            for (size_t i = 0; i < lineNo % LINE_INDEX_STRIDE; i++) {
+                line = static_cast<const char *>(memchr(line, '\n', static_cast<size_t>(end - line))) + 1;
+            }
+        }
+    } else {
+        line = entry;
+        for (size_t i = 0; i < lineNo && line != NULL; i++) {
+            line = static_cast<const char *>(memchr(line, '\n', static_cast<size_t>(end - line)));
+            if (line != NULL && ++line == end) {
+                line = NULL;
+            }
+        }
+        if (length == 0) {
+            line = NULL;
+        }
+    }
+
+    if (line == NULL) {
         std::ostringstream message;
-        message << "Could not open index file " << indexFileName;
+        message << "Line " << lineNo << " out of bounds";
         throw Php::Exception(message.str());
     }
 
-    char *save;
-    size_t i = 0;
-    std::string line;
-    while (std::getline(indexFile, line)) {
-        char *l = (char *) line.c_str();
-        readIndexId<T>(&index[i].id, l, &save);
-        size_t offset = strtoull(strtok_r(NULL, "\t", &save), NULL, 10);
-        size_t length = strtoull(strtok_r(NULL, "\t", &save), NULL, 10);
-        if (i >= size) {
+    const char *newline = static_cast<const char *>(memchr(line, '\n', static_cast<size_t>(end - line)));
+    if (newline == NULL) {
+        newline = end;
+    }
+    return Php::Value(line, static_cast<int>(newline - line));
+}
+
+void checkSchema(const std::string &schema) {
+    for (size_t i = 0; i < schema.size(); i++) {
+        if (schema[i] != 's' && schema[i] != 'i' && schema[i] != 'f') {
             std::ostringstream message;
-            message << "Could not read index entry in line " << i;
+            message << "Invalid column type " << schema[i] << " in schema";
             throw Php::Exception(message.str());
         }
+    }
+}
 
-        index[i].length = length;
+template<typename T>
+Php::Value DBReader<T>::parseRecords(size_t id, const std::string &schema) {
+    size_t length;
+    const char *pos = getEntry(id, &length);
+    const char *end = pos + length;
+
+    Php::Array records;
+    Php::Array fields;
+    int row = 0;
+    int column = 0;
+    // an entry that ends with a tab still has an empty last field in its last row
+    while (pos < end || column > 0) {
+        const char *delimiter = findDelimiter(pos, end);
+        if (column == 0 && delimiter == pos && *delimiter == '\n') {
+            // skip empty lines
+            pos++;
+            continue;
+        }
 
-        if (dataMode & USE_DATA) {
-            index[i].offset = offset;
+        char type = static_cast<size_t>(column) < schema.size() ? schema[column] : 's';
+        if (type == 'i') {
+            fields[column] = parseInt(pos, delimiter);
+        } else if (type == 'f') {
+            fields[column] = parseFloat(pos, delimiter);
         } else {
-            index[i].offset = 0;
+            fields[column] = Php::Value(pos, static_cast<int>(delimiter - pos));
+        }
+        column++;
+
+        if (delimiter == end) {
+            records[row] = fields;
+            break;
         }
+        if (*delimiter == '\n') {
+            records[row] = fields;
+            fields = Php::Array();
+            row++;
+            column = 0;
+        }
+        pos = delimiter + 1;
+    }
 
+    return records;
+}
+
+template<typename T>
+Php::Value DBReader<T>::getRecords(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    size_t id = static_cast<size_t>((int64_t) params[0]);
+    std::string schema;
+    if (params.size() > 1) {
+        schema = params[1].stringValue();
+        checkSchema(schema);
+    }
+
+    return parseRecords(id, schema);
+}
+
+template<typename T>
+Php::Value DBReader<T>::getRecordsBatch(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    if (!params[0].isArray()) {
+        throw Php::Exception("Expected an array of ids");
+    }
+
+    std::string schema;
+    if (params.size() > 1) {
+        schema = params[1].stringValue();
+        checkSchema(schema);
+    }
+
+    Php::Array result;
+    int i = 0;
+    for (auto &iter : params[0]) {
+        result[i] = parseRecords(static_cast<size_t>((int64_t) iter.second), schema);
         i++;
     }
+    return result;
+}
+
+template<typename T>
+Php::Value DBReader<T>::getLength(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
 
-    indexFile.close();
+    size_t id = static_cast<size_t>((int64_t) params[0]);
+
+    checkBounds(id, static_cast<size_t>(size));
+
+    return (int64_t) index[id].length;
 }
 
 template<typename T>
-void DBReader<T>::sortIndex() { }
+Php::Value DBReader<T>::getOffset(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
 
-template<>
-void DBReader<int32_t>::sortIndex() {
-    std::stable_sort(index, index + size, compareIndexLengthPairById());
+    size_t id = static_cast<size_t>((int64_t) params[0]);
+
+    checkBounds(id, static_cast<size_t>(size));
+
+    return static_cast<int64_t>(index[id].offset);
 }
 
 template
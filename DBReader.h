@@ -8,21 +8,47 @@
 // & Maria Hauser mhauser@genzentrum.lmu.de
 //
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <sys/stat.h>
 
 #include <phpcpp.h>
 
+#include "BloomFilter.h"
+#include "DBIndex.h"
+#include "LookupIndex.h"
+
+void checkBounds(size_t id, size_t size);
+
+struct io_uring;
+
+template<typename T>
+class MultiDBReader;
+
 template<typename T>
 class DBReader : public Php::Base {
 public:
     static const int USE_DATA = 1;
     static const int USE_WRITABLE = 2;
+    // index and filter live in a read-only shared memory segment that is built once per host
+    static const int USE_SHARED = 4;
+    // entries are read with pread into a reused buffer instead of mmapping the data file
+    static const int USE_PREAD = 8;
 
     void __construct(Php::Parameters &params);
 
     void __destruct();
 
+    // used by __construct and __destruct, also usable from C++ without PHP parameters
+    void openDatabase(const std::string &dataFileName, const std::string &indexFileName, int dataMode);
+
+    void closeDatabase();
+
     Php::Value getSize() {
         return (int64_t) size;
     }
@@ -34,8 +60,37 @@ public:
     // does a binary search in the ffindex and returns index of the entry with dbKey
     Php::Value getId(Php::Parameters &params);
 
+    // resolves an array of dbKeys at once, misses are reported as -1
+    Php::Value getIds(Php::Parameters &params);
+
+    // opens an MMseqs .lookup file to resolve accessions to dbKeys
+    void openLookup(Php::Parameters &params);
+
+    Php::Value getLookupKey(Php::Parameters &params);
+
+    // returns the index of the entry with the dbKey of an accession
+    Php::Value getIdByAccession(Php::Parameters &params);
+
     Php::Value getData(Php::Parameters &params);
 
+    // returns the entries of an array of ids, in USE_PREAD mode the reads are issued together
+    Php::Value getDataBatch(Php::Parameters &params);
+
+    // returns a read-only PHP stream over the entry that is read in chunks
+    Php::Value getStream(Php::Parameters &params);
+
+    // returns at most len bytes of the entry starting at byte start
+    Php::Value getDataSlice(Php::Parameters &params);
+
+    // returns the zero-based line lineNo of the entry without its newline
+    Php::Value getDataLine(Php::Parameters &params);
+
+    // splits a tab separated entry into rows of fields, schema has one type
+    // character per column: s for string, i for integer and f for float
+    Php::Value getRecords(Php::Parameters &params);
+
+    Php::Value getRecordsBatch(Php::Parameters &params);
+
     Php::Value getDbKey(Php::Parameters &params);
 
     Php::Value getLength(Php::Parameters &params);
@@ -43,11 +98,7 @@ public:
     Php::Value getOffset(Php::Parameters &params);
 
 
-    struct Index {
-        T id;
-        size_t length;
-        size_t offset;
-    };
+    typedef IndexEntry<T> Index;
 
 private:
     std::string dataFileName;
@@ -59,28 +110,97 @@ private:
     char *data;
     FILE *dataFile;
 
+    // used instead of data in USE_PREAD mode
+    std::vector<char> readBuffer;
+    static const unsigned IO_QUEUE_DEPTH = 64;
+    struct io_uring *ring;
+
     // number of entries in the index
     ssize_t size;
     Index *index;
     bool loadedFromCache;
-
-    static bool compareById(const Index &x, const Index &y) {
-        return (x.id <= y.id);
-    }
-
-    void readIndex();
-    void sortIndex();
-
-    struct compareIndexLengthPairById {
-        bool operator()(const Index &lhs, const Index &rhs) const {
-            return (lhs.id < rhs.id);
-        }
+    // contentHash of the cache the index was loaded from or saved to
+    uint64_t cacheIdentity;
+
+    // set if index and filter point into a shared memory segment
+    void *sharedSegment;
+    size_t sharedSegmentSize;
+
+    // rejects most keys that are not in the index before the binary search
+    BlockedBloomFilter filter;
+
+    LookupIndex lookup;
+
+    // entries larger than this get a sparse line offset index on first getDataLine
+    static const size_t LINE_INDEX_THRESHOLD = 1024 * 1024;
+    // only every LINE_INDEX_STRIDE-th line offset is kept, the lines in between are found with memchr
+    static const size_t LINE_INDEX_STRIDE = 64;
+    // at most this many entries keep a line index, further ones evict an arbitrary one
+    static const size_t LINE_INDEX_CACHE_SIZE = 16;
+    struct LineIndex {
+        size_t lines;
+        std::vector<size_t> offsets;
     };
-
-    void loadCache(std::string fileName);
-    void saveCache(std::string fileName);
+    std::unordered_map<size_t, LineIndex> lineIndex;
+
+    // number of binary searches that are interleaved in getIds
+    static const size_t LOOKUP_BATCH_SIZE = 16;
+    void lookupBatch(const Index *keys, size_t count, int64_t *ids);
+    // returns -1 if the key is not in the index
+    int64_t findId(const Index &key);
+
+    // in USE_PREAD mode the returned pointer is only valid until the next read
+    const char *getEntry(size_t id, size_t *length);
+    // returns a pointer to byte start of the entry, only count bytes from there are guaranteed to be read
+    const char *getEntryRange(size_t id, size_t start, size_t count, size_t *length);
+    const char *readData(size_t offset, size_t length);
+    void readEntries(const std::vector<size_t> &ids, const std::vector<size_t> &positions, char *buffer);
+    Php::Value parseRecords(size_t id, const std::string &schema);
+    const LineIndex &getLineIndex(size_t id, const char *entry, size_t length);
+
+    void loadIndex(const std::string &cacheFileName);
+    void releaseIndex();
+
+    bool loadCache(const std::string &fileName);
+    void loadFilter(const std::string &cacheFileName);
+
+    void attachShared(const std::string &cacheFileName);
+    bool mapShared(const std::string &segmentName, const struct stat &indexStat);
+    void createShared(const std::string &segmentName, const std::string &cacheFileName,
+                      const struct stat &indexStat);
 
     friend class DBWriter;
+    friend class MultiDBReader<T>;
 };
 
+// returns false if the value can not be a key of the index
+template<typename T>
+inline bool readParameterKey(T *key, const Php::Value &value) {
+    *key = value;
+    return true;
+}
+
+// a longer key would be truncated to the one of another entry
+template<>
+inline bool readParameterKey(char (*key)[32], const Php::Value &value) {
+    std::string identifier = value;
+    if (identifier.size() > 32) {
+        return false;
+    }
+    memset(*key, 0, 32);
+    memcpy(*key, identifier.c_str(), identifier.size());
+    return true;
+}
+
+template<typename T>
+inline Php::Value keyValue(const T &key) {
+    return key;
+}
+
+// keys that use all 32 bytes are not null terminated
+template<>
+inline Php::Value keyValue(const char (&key)[32]) {
+    return Php::Value(key, static_cast<int>(strnlen(key, 32)));
+}
+
 #endif
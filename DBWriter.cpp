@@ -4,6 +4,9 @@
 #include <fstream>
 #include <sys/stat.h>
 #include <algorithm>
+#include <queue>
+#include <thread>
+#include <unistd.h>
 
 #include "DBWriter.h"
 #include "itoa.h"
@@ -19,7 +22,9 @@ void errorIfFileExist(const std::string& file){
 
 DBWriter::DBWriter(const std::string& dataFileName,
                    const std::string& indexFileName,
-                   int32_t mode) : dataFileName(dataFileName), indexFileName(indexFileName) {
+                   int32_t mode,
+                   size_t maxEntriesInMemory) : dataFileName(dataFileName), indexFileName(indexFileName),
+                                                offset(0), entries(0), maxEntriesInMemory(maxEntriesInMemory), runCount(0) {
 
     if (mode == ASCII_MODE) {
         datafileMode = "w";
@@ -50,31 +55,332 @@ DBWriter::DBWriter(const std::string& dataFileName,
     }
 }
 
-void writeIndex(FILE *outFile, DBReader<int32_t>::Index *index, size_t indexSize){
+bool writeIndexEntry(FILE *outFile, const DBReader<int32_t>::Index &entry) {
     char buff1[1024];
+    char * tmpBuff = u32toa_sse2((uint32_t)entry.id, buff1);
+    *(tmpBuff-1) = '\t';
+    size_t currOffset = entry.offset;
+    tmpBuff = u64toa_sse2(currOffset, tmpBuff);
+    *(tmpBuff-1) = '\t';
+    uint32_t sLen = entry.length;
+    tmpBuff = u32toa_sse2(sLen,tmpBuff);
+    *(tmpBuff-1) = '\n';
+    *(tmpBuff) = '\0';
+    size_t length = strlen(buff1);
+    return fwrite(buff1, sizeof(char), length, outFile) == length;
+}
+
+bool writeIndex(FILE *outFile, DBReader<int32_t>::Index *index, size_t indexSize){
     for(size_t id = 0; id < indexSize; id++){
-        char * tmpBuff = u32toa_sse2((uint32_t)index[id].id, buff1);
-        *(tmpBuff-1) = '\t';
-        size_t currOffset = index[id].offset;
-        tmpBuff = u64toa_sse2(currOffset, tmpBuff);
-        *(tmpBuff-1) = '\t';
-        uint32_t sLen = index[id].length;
-        tmpBuff = u32toa_sse2(sLen,tmpBuff);
-        *(tmpBuff-1) = '\n';
-        *(tmpBuff) = '\0';
-        fwrite(buff1, sizeof(char), strlen(buff1), outFile);
+        if (!writeIndexEntry(outFile, index[id])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// stable LSD radix sort over the 32 bit keys, every pass splits the entries
+// into one chunk per thread, counts the digits per chunk and scatters each chunk
+// to the positions given by the prefix sum over all chunks
+void radixSortIndex(std::vector<DBReader<int32_t>::Index> &index) {
+    typedef DBReader<int32_t>::Index Index;
+    const size_t RADIX = 256;
+
+    size_t n = index.size();
+    if (n < 2) {
+        return;
+    }
+
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    // small inputs are not worth starting threads for
+    threads = std::min(threads, std::max(static_cast<size_t>(1), n / (64 * 1024)));
+    size_t chunk = (n + threads - 1) / threads;
+
+    std::vector<Index> buffer(n);
+    Index *src = index.data();
+    Index *dst = buffer.data();
+    std::vector<size_t> counts(threads * RADIX);
+
+    for (unsigned shift = 0; shift < 32; shift += 8) {
+        // flipping the sign bit orders negative keys first
+        auto digit = [shift](const Index &entry) {
+            return ((static_cast<uint32_t>(entry.id) ^ 0x80000000u) >> shift) & (RADIX - 1);
+        };
+
+        std::fill(counts.begin(), counts.end(), 0);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                size_t *count = counts.data() + t * RADIX;
+                for (size_t i = t * chunk; i < std::min(n, (t + 1) * chunk); i++) {
+                    count[digit(src[i])]++;
+                }
+            });
+        }
+        for (size_t t = 0; t < threads; t++) {
+            workers[t].join();
+        }
+
+        // skip passes where all keys share the same digit
+        bool trivial = false;
+        for (size_t d = 0; d < RADIX; d++) {
+            size_t total = 0;
+            for (size_t t = 0; t < threads; t++) {
+                total += counts[t * RADIX + d];
+            }
+            if (total == n) {
+                trivial = true;
+                break;
+            }
+        }
+        if (trivial) {
+            continue;
+        }
+
+        size_t sum = 0;
+        for (size_t d = 0; d < RADIX; d++) {
+            for (size_t t = 0; t < threads; t++) {
+                size_t count = counts[t * RADIX + d];
+                counts[t * RADIX + d] = sum;
+                sum += count;
+            }
+        }
+
+        workers.clear();
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                size_t *position = counts.data() + t * RADIX;
+                for (size_t i = t * chunk; i < std::min(n, (t + 1) * chunk); i++) {
+                    dst[position[digit(src[i])]++] = src[i];
+                }
+            });
+        }
+        for (size_t t = 0; t < threads; t++) {
+            workers[t].join();
+        }
+        std::swap(src, dst);
+    }
+
+    if (src != index.data()) {
+        index.swap(buffer);
+    }
+}
+
+std::string DBWriter::nextRunFileName() {
+    return indexFileName + ".run." + std::to_string(getpid()) + "." + std::to_string(runCount++);
+}
+
+void DBWriter::spillRun() {
+    radixSortIndex(index);
+
+    std::string runFileName = nextRunFileName();
+    FILE *runFile = fopen(runFileName.c_str(), "wb");
+    if (runFile == NULL) {
+        std::ostringstream message;
+        message << "Could not create run file " << runFileName;
+        throw Php::Exception(message.str());
+    }
+    size_t written = fwrite(index.data(), sizeof(DBReader<int32_t>::Index), index.size(), runFile);
+    if (fclose(runFile) != 0 || written != index.size()) {
+        remove(runFileName.c_str());
+        std::ostringstream message;
+        message << "Could not write run file " << runFileName;
+        throw Php::Exception(message.str());
+    }
+
+    runFileNames.push_back(runFileName);
+    index.clear();
+}
+
+struct RunReader {
+    // the buffers of all merged runs together stay close to maxEntriesInMemory
+    static const size_t MIN_BUFFER_ENTRIES = 1024;
+    static const size_t MAX_BUFFER_ENTRIES = 64 * 1024;
+
+    std::string fileName;
+    FILE *file;
+    size_t bufferEntries;
+    std::vector<DBReader<int32_t>::Index> buffer;
+    size_t pos;
+
+    RunReader() : file(NULL), bufferEntries(MIN_BUFFER_ENTRIES), pos(0) {}
+
+    RunReader(const RunReader &) = delete;
+    RunReader &operator=(const RunReader &) = delete;
+
+    ~RunReader() {
+        if (file != NULL) {
+            fclose(file);
+        }
+    }
+
+    bool next(DBReader<int32_t>::Index *entry) {
+        if (pos == buffer.size()) {
+            buffer.resize(bufferEntries);
+            buffer.resize(fread(buffer.data(), sizeof(DBReader<int32_t>::Index), bufferEntries, file));
+            pos = 0;
+            // a short read is only the end of the run if it was not caused by an error
+            if (ferror(file) != 0) {
+                std::ostringstream message;
+                message << "Could not read run file " << fileName;
+                throw Php::Exception(message.str());
+            }
+            if (buffer.empty()) {
+                return false;
+            }
+        }
+        *entry = buffer[pos++];
+        return true;
+    }
+};
+
+const size_t RunReader::MIN_BUFFER_ENTRIES;
+const size_t RunReader::MAX_BUFFER_ENTRIES;
+const size_t DBWriter::MAX_MERGE_FAN_IN;
+
+// k-way merge of count runs starting at first, either into another run or as index lines,
+// ties are resolved by run order so the output matches a stable sort
+void DBWriter::mergeRunFiles(size_t first, size_t count, FILE *outFile, bool binary) {
+    typedef std::pair<int32_t, size_t> Head;
+
+    size_t bufferEntries = std::min(RunReader::MAX_BUFFER_ENTRIES,
+                                    std::max(RunReader::MIN_BUFFER_ENTRIES, maxEntriesInMemory / count));
+    std::vector<RunReader> runs(count);
+    std::vector<DBReader<int32_t>::Index> current(count);
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (size_t i = 0; i < count; i++) {
+        runs[i].fileName = runFileNames[first + i];
+        runs[i].file = fopen(runs[i].fileName.c_str(), "rb");
+        runs[i].bufferEntries = bufferEntries;
+        if (runs[i].file == NULL) {
+            std::ostringstream message;
+            message << "Could not open run file " << runs[i].fileName;
+            throw Php::Exception(message.str());
+        }
+        if (runs[i].next(&current[i])) {
+            heads.push(Head(current[i].id, i));
+        }
+    }
+
+    while (!heads.empty()) {
+        size_t i = heads.top().second;
+        heads.pop();
+        if (binary) {
+            if (fwrite(&current[i], sizeof(DBReader<int32_t>::Index), 1, outFile) != 1) {
+                throw Php::Exception("Could not write merged run file");
+            }
+        } else if (!writeIndexEntry(outFile, current[i])) {
+            std::ostringstream message;
+            message << "Could not write " << indexFileName;
+            throw Php::Exception(message.str());
+        }
+        if (runs[i].next(&current[i])) {
+            heads.push(Head(current[i].id, i));
+        }
+    }
+}
+
+void DBWriter::mergeRuns() {
+    // every pass merges neighbouring groups into a run at the place of the group, which keeps ties stable
+    while (runFileNames.size() > MAX_MERGE_FAN_IN) {
+        for (size_t first = 0; first < runFileNames.size(); first++) {
+            size_t count = std::min(MAX_MERGE_FAN_IN, runFileNames.size() - first);
+            if (count == 1) {
+                continue;
+            }
+
+            std::string runFileName = nextRunFileName();
+            FILE *runFile = fopen(runFileName.c_str(), "wb");
+            if (runFile == NULL) {
+                std::ostringstream message;
+                message << "Could not create run file " << runFileName;
+                throw Php::Exception(message.str());
+            }
+            try {
+                mergeRunFiles(first, count, runFile, true);
+            } catch (...) {
+                fclose(runFile);
+                remove(runFileName.c_str());
+                throw;
+            }
+            bool failed = ferror(runFile) != 0;
+            if (fclose(runFile) != 0 || failed) {
+                remove(runFileName.c_str());
+                std::ostringstream message;
+                message << "Could not write run file " << runFileName;
+                throw Php::Exception(message.str());
+            }
+
+            for (size_t i = first; i < first + count; i++) {
+                remove(runFileNames[i].c_str());
+            }
+            runFileNames.erase(runFileNames.begin() + first, runFileNames.begin() + first + count);
+            runFileNames.insert(runFileNames.begin() + first, runFileName);
+        }
+    }
+
+    mergeRunFiles(0, runFileNames.size(), indexFile, false);
+
+    for (size_t i = 0; i < runFileNames.size(); i++) {
+        remove(runFileNames[i].c_str());
+    }
+    runFileNames.clear();
+}
+
+void DBWriter::close() {
+    if (dataFile == NULL) {
+        return;
+    }
+
+    if (runFileNames.empty()) {
+        radixSortIndex(index);
+        if (!writeIndex(indexFile, index.data(), index.size())) {
+            std::ostringstream message;
+            message << "Could not write " << indexFileName;
+            throw Php::Exception(message.str());
+        }
+    } else {
+        if (!index.empty()) {
+            spillRun();
+        }
+        mergeRuns();
+    }
+
+    // fclose does not report errors of earlier buffered writes, the error indicators keep them
+    bool dataWritten = fflush(dataFile) == 0 && ferror(dataFile) == 0;
+    bool indexWritten = fflush(indexFile) == 0 && ferror(indexFile) == 0;
+    bool dataClosed = fclose(dataFile) == 0 && dataWritten;
+    bool indexClosed = fclose(indexFile) == 0 && indexWritten;
+    dataFile = NULL;
+    indexFile = NULL;
+    if (!dataClosed || !indexClosed) {
+        std::ostringstream message;
+        message << "Could not write " << (dataClosed ? indexFileName : dataFileName);
+        throw Php::Exception(message.str());
     }
 }
 
 DBWriter::~DBWriter() {
-    std::stable_sort(index.begin(), index.end(), DBReader<int32_t>::compareIndexLengthPairById());
-    writeIndex(indexFile, index.data(), entries);
+    // errors can only be reported by close, a destructor must not throw
+    try {
+        close();
+    } catch (...) {
+    }
 
-    fclose(dataFile);
-    fclose(indexFile);
+    if (dataFile != NULL) {
+        fclose(dataFile);
+        fclose(indexFile);
+    }
+    for (size_t i = 0; i < runFileNames.size(); i++) {
+        remove(runFileNames[i].c_str());
+    }
 }
 
 void DBWriter::write(int32_t key, const std::string& data) {
+    if (dataFile == NULL) {
+        throw Php::Exception("DBWriter is already closed");
+    }
+
     size_t offsetStart = offset;
     size_t dataSize = data.length();
     size_t written = fwrite(data.c_str(), sizeof(char), dataSize, dataFile);
@@ -99,8 +405,12 @@ void DBWriter::write(int32_t key, const std::string& data) {
     DBReader<int32_t>::Index entry;
     entry.id = key;
     entry.length = length;
-    entry.offset = offset;
+    entry.offset = offsetStart;
     index.push_back(entry);
 
     entries++;
+
+    if (maxEntriesInMemory > 0 && index.size() >= maxEntriesInMemory) {
+        spillRun();
+    }
 }
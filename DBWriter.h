@@ -18,12 +18,19 @@ class DBWriter {
         static const size_t ASCII_MODE = 0;
         static const size_t BINARY_MODE = 1;
 
-        DBWriter(const std::string& dataFileName, const std::string& indexFileName, int32_t mode = ASCII_MODE);
+        // with maxEntriesInMemory > 0 sorted runs of that many entries are spilled next to the index
+        // and merged when the index is written
+        DBWriter(const std::string& dataFileName, const std::string& indexFileName, int32_t mode = ASCII_MODE,
+                 size_t maxEntriesInMemory = 0);
 
+        // closes the writer without reporting errors, call close first to get them
         ~DBWriter();
 
         void write(int32_t key, const std::string& data);
 
+        // merges spilled runs, writes the sorted index and closes both files
+        void close();
+
 private:
     std::string dataFileName;
     std::string indexFileName;
@@ -37,6 +44,19 @@ private:
     std::string datafileMode;
 
     std::vector<DBReader<int32_t>::Index> index;
+
+    size_t maxEntriesInMemory;
+    // runs that still exist on disk, in the order their entries were written
+    std::vector<std::string> runFileNames;
+    size_t runCount;
+
+    // more runs are first merged in groups, so only this many files and buffers are open at once
+    static const size_t MAX_MERGE_FAN_IN = 64;
+
+    std::string nextRunFileName();
+    void spillRun();
+    void mergeRunFiles(size_t first, size_t count, FILE *outFile, bool binary);
+    void mergeRuns();
 };
 
 class PhpDBWriter : public Php::Base {
@@ -48,17 +68,35 @@ public:
 
         int32_t dataMode = DBWriter::ASCII_MODE;
         if (params.size() > 2) {
-            dataMode = (int32_t) params[3];
+            dataMode = (int32_t) params[2];
         }
 
+        size_t maxEntriesInMemory = 0;
+        if (params.size() > 3) {
+            maxEntriesInMemory = static_cast<size_t>((int64_t) params[3]);
+        }
 
-        dbWriter = new DBWriter((const std::string&) params[0], (const std::string&) params[1], dataMode);
+        dbWriter = new DBWriter((const std::string&) params[0], (const std::string&) params[1], dataMode,
+                                maxEntriesInMemory);
     }
 
     void __destruct() {
+        // a failed close is reported to PHP instead of being swallowed by the DBWriter destructor
+        try {
+            dbWriter->close();
+        } catch (...) {
+            delete dbWriter;
+            dbWriter = NULL;
+            throw;
+        }
         delete dbWriter;
+        dbWriter = NULL;
     };
 
+    void close() {
+        dbWriter->close();
+    }
+
     void write(Php::Parameters &params) {
         if (params.size() < 2) {
             throw Php::Exception("Not enough parameters");
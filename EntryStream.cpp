@@ -0,0 +1,120 @@
+#include "EntryStream.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include <php.h>
+
+#if PHP_VERSION_ID >= 70400
+typedef ssize_t stream_result_t;
+#define STREAM_ERROR -1
+#else
+typedef size_t stream_result_t;
+#define STREAM_ERROR 0
+#endif
+
+struct EntryStream {
+    const char *data;
+    int fd;
+    size_t offset;
+    size_t length;
+    size_t position;
+    Php::Value owner;
+};
+
+static stream_result_t entryStreamWrite(php_stream *, const char *, size_t) {
+    return STREAM_ERROR;
+}
+
+static stream_result_t entryStreamRead(php_stream *stream, char *buf, size_t count) {
+    EntryStream *entry = static_cast<EntryStream *>(stream->abstract);
+    size_t n = std::min(count, entry->length - entry->position);
+    if (entry->data != NULL) {
+        memcpy(buf, entry->data + entry->position, n);
+    } else if (n > 0) {
+        ssize_t r = pread(entry->fd, buf, n, static_cast<off_t>(entry->offset + entry->position));
+        if (r < 0) {
+            return STREAM_ERROR;
+        }
+        n = static_cast<size_t>(r);
+    }
+
+    entry->position += n;
+    if (entry->position == entry->length) {
+        stream->eof = 1;
+    }
+    return static_cast<stream_result_t>(n);
+}
+
+static int entryStreamClose(php_stream *stream, int) {
+    delete static_cast<EntryStream *>(stream->abstract);
+    return 0;
+}
+
+static int entryStreamFlush(php_stream *) {
+    return 0;
+}
+
+static int entryStreamSeek(php_stream *stream, zend_off_t offset, int whence, zend_off_t *newOffset) {
+    EntryStream *entry = static_cast<EntryStream *>(stream->abstract);
+    zend_off_t target;
+    switch (whence) {
+        case SEEK_SET:
+            target = offset;
+            break;
+        case SEEK_CUR:
+            target = static_cast<zend_off_t>(entry->position) + offset;
+            break;
+        case SEEK_END:
+            target = static_cast<zend_off_t>(entry->length) + offset;
+            break;
+        default:
+            return -1;
+    }
+
+    if (target < 0 || static_cast<size_t>(target) > entry->length) {
+        return -1;
+    }
+
+    entry->position = static_cast<size_t>(target);
+    stream->eof = 0;
+    *newOffset = target;
+    return 0;
+}
+
+static php_stream_ops entryStreamOps = {
+        entryStreamWrite,
+        entryStreamRead,
+        entryStreamClose,
+        entryStreamFlush,
+        "dbreader entry",
+        entryStreamSeek,
+        NULL,
+        NULL,
+        NULL
+};
+
+Php::Value createEntryStream(const char *data, int fd, size_t offset, size_t length, const Php::Value &owner) {
+    EntryStream *entry = new EntryStream;
+    entry->data = data;
+    entry->fd = fd;
+    entry->offset = offset;
+    entry->length = length;
+    entry->position = 0;
+    entry->owner = owner;
+
+    php_stream *stream = php_stream_alloc(&entryStreamOps, entry, NULL, "rb");
+    if (stream == NULL) {
+        delete entry;
+        throw Php::Exception("Could not create stream");
+    }
+
+    zval resource;
+    php_stream_to_zval(stream, &resource);
+    // the Php::Value holds its own reference to the resource
+    Php::Value result(&resource);
+    zval_ptr_dtor(&resource);
+    return result;
+}
@@ -0,0 +1,16 @@
+#ifndef ENTRYSTREAM_H
+#define ENTRYSTREAM_H
+
+// Read-only PHP stream over a single DB entry, so large entries can be passed to
+// fpassthru or stream_copy_to_stream in chunks instead of being copied into one string.
+//
+
+#include <cstddef>
+
+#include <phpcpp.h>
+
+// reads from data if it is not NULL, otherwise with pread from fd starting at offset;
+// owner is referenced by the stream to keep the reader and its data alive
+Php::Value createEntryStream(const char *data, int fd, size_t offset, size_t length, const Php::Value &owner);
+
+#endif
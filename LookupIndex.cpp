@@ -0,0 +1,232 @@
+#include "LookupIndex.h"
+#include "DBIndex.h"
+#include "DBKey.h"
+#include "RecordParser.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct LookupHeader {
+    static const uint64_t MAGIC = 0x4B4F4F4C424450ULL;
+
+    uint64_t magic;
+    uint64_t entries;
+    uint64_t slots;
+    uint64_t stringBytes;
+    // identifies the lookup file the cache was built from, the inode is left out so that copies stay valid
+    uint64_t lookupFileSize;
+    int64_t lookupModified;
+    int64_t lookupModifiedNsec;
+};
+
+uint64_t hashAccession(const char *accession, size_t length) {
+    return mixHash(hashBytes(accession, length));
+}
+
+void LookupIndex::open(const std::string &lookupFileName) {
+    close();
+
+    struct stat lookupStat;
+    if (stat(lookupFileName.c_str(), &lookupStat) != 0) {
+        std::ostringstream message;
+        message << "Could not open lookup file " << lookupFileName;
+        throw std::runtime_error(message.str());
+    }
+
+    // a cache that is missing, in an old layout or built from another version of the lookup is rebuilt
+    std::string cacheFileName = lookupFileName + ".cache";
+    if (load(cacheFileName, lookupStat)) {
+        return;
+    }
+    std::string contents = build(lookupFileName);
+    writeFileAtomically(cacheFileName, {{contents.data(), contents.size()}});
+    if (!load(cacheFileName, lookupStat)) {
+        std::ostringstream message;
+        message << "Invalid lookup cache " << cacheFileName;
+        throw std::runtime_error(message.str());
+    }
+}
+
+void LookupIndex::close() {
+    if (cache != NULL) {
+        munmap(cache, cacheSize);
+    }
+    cache = NULL;
+    cacheSize = 0;
+    slots = NULL;
+    numSlots = 0;
+    strings = NULL;
+    entries = 0;
+}
+
+std::string LookupIndex::build(const std::string &lookupFileName) {
+    FILE *file = fopen(lookupFileName.c_str(), "r");
+    if (file == NULL) {
+        std::ostringstream message;
+        message << "Could not open lookup file " << lookupFileName;
+        throw std::runtime_error(message.str());
+    }
+
+    struct stat lookupStat;
+    fstat(fileno(file), &lookupStat);
+
+    ssize_t fileSize;
+    char *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && ftell(file) > 0) {
+        data = mmapData(file, &fileSize, false);
+    } else {
+        fileSize = 0;
+    }
+    fclose(file);
+    if (data == MAP_FAILED) {
+        std::ostringstream message;
+        message << "Could not read lookup file " << lookupFileName;
+        throw std::runtime_error(message.str());
+    }
+
+    const char *end = data + fileSize;
+    size_t lines = 0;
+    for (const char *pos = data; pos < end; lines++) {
+        const char *newline = static_cast<const char *>(memchr(pos, '\n', static_cast<size_t>(end - pos)));
+        pos = (newline == NULL) ? end : newline + 1;
+    }
+
+    // keep the load factor at or below one half
+    size_t slotCount = 16;
+    while (slotCount < 2 * lines) {
+        slotCount *= 2;
+    }
+    size_t mask = slotCount - 1;
+
+    Slot empty;
+    empty.hash = 0;
+    empty.offset = EMPTY;
+    empty.length = 0;
+    empty.key = 0;
+    std::vector<Slot> table(slotCount, empty);
+    std::string pool;
+    size_t count = 0;
+
+    const char *pos = data;
+    while (pos < end) {
+        const char *lineEnd = static_cast<const char *>(memchr(pos, '\n', static_cast<size_t>(end - pos)));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+
+        const char *keyEnd = findDelimiter(pos, lineEnd);
+        if (keyEnd == lineEnd) {
+            pos = lineEnd + 1;
+            continue;
+        }
+        const char *accession = keyEnd + 1;
+        size_t length = static_cast<size_t>(findDelimiter(accession, lineEnd) - accession);
+        int32_t key = static_cast<int32_t>(parseInt(pos, keyEnd));
+
+        uint64_t h = hashAccession(accession, length);
+        size_t i = h & mask;
+        bool duplicate = false;
+        while (table[i].offset != EMPTY) {
+            if (table[i].hash == h && table[i].length == length
+                && memcmp(pool.data() + table[i].offset, accession, length) == 0) {
+                // the first key of an accession wins
+                duplicate = true;
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+
+        if (!duplicate) {
+            table[i].hash = h;
+            table[i].offset = pool.size();
+            table[i].length = static_cast<uint32_t>(length);
+            table[i].key = key;
+            pool.append(accession, length);
+            pool.push_back('\0');
+            count++;
+        }
+
+        pos = lineEnd + 1;
+    }
+
+    if (data != NULL) {
+        munmap(data, static_cast<size_t>(fileSize));
+    }
+
+    LookupHeader header;
+    memset(&header, 0, sizeof(LookupHeader));
+    header.magic = LookupHeader::MAGIC;
+    header.entries = count;
+    header.slots = slotCount;
+    header.stringBytes = pool.size();
+    header.lookupFileSize = static_cast<uint64_t>(lookupStat.st_size);
+    header.lookupModified = static_cast<int64_t>(lookupStat.st_mtim.tv_sec);
+    header.lookupModifiedNsec = static_cast<int64_t>(lookupStat.st_mtim.tv_nsec);
+
+    std::string cache;
+    cache.reserve(sizeof(LookupHeader) + slotCount * sizeof(Slot) + pool.size());
+    cache.append(reinterpret_cast<const char *>(&header), sizeof(LookupHeader));
+    cache.append(reinterpret_cast<const char *>(table.data()), slotCount * sizeof(Slot));
+    cache.append(pool);
+    return cache;
+}
+
+bool LookupIndex::load(const std::string &cacheFileName, const struct stat &lookupStat) {
+    FILE *file = fopen(cacheFileName.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fileno(file), &sb) != 0 || static_cast<size_t>(sb.st_size) < sizeof(LookupHeader)) {
+        fclose(file);
+        return false;
+    }
+
+    ssize_t fileSize;
+    char *map = mmapData(file, &fileSize, false);
+    fclose(file);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    cache = map;
+    cacheSize = static_cast<size_t>(fileSize);
+
+    const LookupHeader *header = (const LookupHeader *) map;
+    if (header->magic != LookupHeader::MAGIC || header->slots == 0 || (header->slots & (header->slots - 1)) != 0
+        || sizeof(LookupHeader) + header->slots * sizeof(Slot) + header->stringBytes != cacheSize
+        || header->lookupFileSize != static_cast<uint64_t>(lookupStat.st_size)
+        || header->lookupModified != static_cast<int64_t>(lookupStat.st_mtim.tv_sec)
+        || header->lookupModifiedNsec != static_cast<int64_t>(lookupStat.st_mtim.tv_nsec)) {
+        close();
+        return false;
+    }
+
+    entries = static_cast<size_t>(header->entries);
+    numSlots = static_cast<size_t>(header->slots);
+    slots = (const Slot *) (map + sizeof(LookupHeader));
+    strings = map + sizeof(LookupHeader) + numSlots * sizeof(Slot);
+    return true;
+}
+
+bool LookupIndex::find(const char *accession, size_t length, int32_t *key) const {
+    if (slots == NULL) {
+        return false;
+    }
+
+    uint64_t h = hashAccession(accession, length);
+    size_t mask = numSlots - 1;
+    for (size_t i = h & mask; slots[i].offset != EMPTY; i = (i + 1) & mask) {
+        if (slots[i].hash == h && slots[i].length == length
+            && memcmp(strings + slots[i].offset, accession, length) == 0) {
+            *key = slots[i].key;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,67 @@
+#ifndef LOOKUPINDEX_H
+#define LOOKUPINDEX_H
+
+// Maps accessions to the integer keys of an MMseqs DB using its .lookup file
+// (key, accession and file number separated by tabs).
+// The parsed lookup is kept in <lookup>.cache as an open addressing hash table
+// followed by the accession strings, so later opens only need to mmap it.
+// The cache is rebuilt when the size or modification time of the lookup file changes.
+// Errors are reported as std::runtime_error.
+//
+
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+
+#include <sys/stat.h>
+
+class LookupIndex {
+public:
+    LookupIndex() : cache(NULL), cacheSize(0), slots(NULL), numSlots(0), strings(NULL), entries(0) { }
+
+    ~LookupIndex() {
+        close();
+    }
+
+    void open(const std::string &lookupFileName);
+
+    void close();
+
+    bool isOpen() const {
+        return cache != NULL;
+    }
+
+    size_t size() const {
+        return entries;
+    }
+
+    // returns false if the accession is not in the lookup
+    bool find(const char *accession, size_t length, int32_t *key) const;
+
+    struct Slot {
+        uint64_t hash;
+        // offset of the accession in the string pool, EMPTY marks an unused slot
+        uint64_t offset;
+        uint32_t length;
+        int32_t key;
+    };
+
+    static const uint64_t EMPTY = UINT64_MAX;
+
+    // returns the contents of the cache for the lookup file, used by open and the dbreader_cache tool
+    static std::string build(const std::string &lookupFileName);
+
+private:
+    void *cache;
+    size_t cacheSize;
+
+    const Slot *slots;
+    size_t numSlots;
+    const char *strings;
+    size_t entries;
+
+    // returns false if the cache is missing, invalid or was built from another version of the lookup
+    bool load(const std::string &cacheFileName, const struct stat &lookupStat);
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include "MultiDBReader.h"
+#include "DBKey.h"
+
+#include <sstream>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct MultiIndexHeader {
+    static const uint64_t MAGIC = 0x4D444249424450ULL;
+
+    uint64_t magic;
+    uint64_t keySize;
+    uint64_t columns;
+    uint64_t entries;
+    // size and modification time of all column indices when the cache was built
+    uint64_t indexStamp;
+};
+
+static uint64_t indexStamp(const std::vector<std::string> &indexFileNames) {
+    uint64_t h = mixHash(static_cast<uint64_t>(indexFileNames.size()));
+    for (size_t i = 0; i < indexFileNames.size(); i++) {
+        struct stat sb;
+        if (stat(indexFileNames[i].c_str(), &sb) != 0) {
+            std::ostringstream message;
+            message << "Could not open index file " << indexFileNames[i];
+            throw Php::Exception(message.str());
+        }
+        h = mixHash(h ^ static_cast<uint64_t>(sb.st_size));
+        h = mixHash(h ^ static_cast<uint64_t>(sb.st_mtim.tv_sec));
+        h = mixHash(h ^ static_cast<uint64_t>(sb.st_mtim.tv_nsec));
+    }
+    return h;
+}
+
+template<typename T>
+void MultiDBReader<T>::__construct(Php::Parameters &params) {
+    if (params.size() < 2) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    if (!params[0].isArray() || !params[1].isArray() || params[0].size() != params[1].size()
+        || params[0].size() == 0) {
+        throw Php::Exception("Expected arrays of data and index files of the same size");
+    }
+
+    cache = NULL;
+
+    std::vector<std::string> indexFileNames;
+    for (auto &iter : params[0]) {
+        dataFileNames.push_back(iter.second.stringValue());
+    }
+    for (auto &iter : params[1]) {
+        indexFileNames.push_back(iter.second.stringValue());
+    }
+    columns = dataFileNames.size();
+
+    // PHP does not call __destruct if the constructor throws
+    try {
+        for (size_t i = 0; i < columns; i++) {
+            FILE *file = fopen(dataFileNames[i].c_str(), "r");
+            if (file == NULL) {
+                std::ostringstream message;
+                message << "Could not open data file " << dataFileNames[i];
+                throw Php::Exception(message.str());
+            }
+            ssize_t dataSize;
+            dataFiles.push_back(file);
+            data.push_back(mmapData(file, &dataSize, false));
+            dataSizes.push_back(dataSize);
+        }
+
+        // the cache depends on all column index files, not only on the first one
+        std::string joinedNames;
+        for (size_t i = 0; i < columns; i++) {
+            joinedNames.append(indexFileNames[i]);
+            joinedNames.push_back('\0');
+        }
+        std::ostringstream cacheFileName;
+        cacheFileName << indexFileNames[0] << ".cache.multi." << std::hex << hashBytes(joinedNames.data(), joinedNames.size())
+                      << "." << typeid(T).name() << ".v" << INDEX_CACHE_VERSION;
+
+        // stat before reading, so that a change during the build leaves a stale cache behind
+        uint64_t stamp = indexStamp(indexFileNames);
+        if (!loadCache(cacheFileName.str(), stamp)) {
+            buildCache(indexFileNames, cacheFileName.str(), stamp);
+            if (!loadCache(cacheFileName.str(), stamp)) {
+                std::ostringstream message;
+                message << "Could not load index cache from " << cacheFileName.str();
+                throw Php::Exception(message.str());
+            }
+        }
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+template<typename T>
+void MultiDBReader<T>::__destruct() {
+    release();
+}
+
+template<typename T>
+void MultiDBReader<T>::release() {
+    for (size_t i = 0; i < dataFiles.size(); i++) {
+        if (data[i] != MAP_FAILED) {
+            munmap(data[i], static_cast<size_t>(dataSizes[i]));
+        }
+        fclose(dataFiles[i]);
+    }
+    dataFiles.clear();
+    data.clear();
+    dataSizes.clear();
+
+    if (cache != NULL) {
+        munmap(cache, cacheSize);
+        cache = NULL;
+    }
+}
+
+template<typename T>
+void MultiDBReader<T>::buildCache(const std::vector<std::string> &indexFileNames, const std::string &fileName,
+                                  uint64_t stamp) {
+    typedef IndexEntry<T> Index;
+
+    std::vector<std::vector<Index> > indices(columns);
+    try {
+        for (size_t column = 0; column < columns; column++) {
+            indices[column].resize(countLines(indexFileNames[column]));
+            readIndexFile<T>(indexFileNames[column], true, indices[column].data(), indices[column].size());
+            sortIndexEntries<T>(indices[column].data(), indices[column].size());
+        }
+    } catch (const std::runtime_error &e) {
+        throw Php::Exception(e.what());
+    }
+
+    // the first column defines the key space
+    const std::vector<Index> &first = indices[0];
+    size_t rows = first.size();
+
+    size_t keyBytes = (rows * sizeof(Key) + 7) & ~static_cast<size_t>(7);
+    std::vector<char> buffer(sizeof(MultiIndexHeader) + keyBytes + rows * columns * sizeof(Entry), 0);
+    MultiIndexHeader *header = (MultiIndexHeader *) buffer.data();
+    header->magic = MultiIndexHeader::MAGIC;
+    header->keySize = sizeof(Key);
+    header->columns = columns;
+    header->entries = rows;
+    header->indexStamp = stamp;
+    Key *rowKeys = (Key *) (buffer.data() + sizeof(MultiIndexHeader));
+    Entry *rowEntries = (Entry *) (buffer.data() + sizeof(MultiIndexHeader) + keyBytes);
+
+    for (size_t i = 0; i < rows; i++) {
+        memcpy(&rowKeys[i].id, &first[i].id, sizeof(T));
+        rowEntries[i * columns].offset = first[i].offset;
+        rowEntries[i * columns].length = first[i].length;
+    }
+
+    // both indices are sorted by key, entries without a match keep a length of zero
+    for (size_t column = 1; column < columns; column++) {
+        const std::vector<Index> &index = indices[column];
+        size_t i = 0;
+        size_t j = 0;
+        while (i < rows && j < index.size()) {
+            if (KeyCompare<T>::less(rowKeys[i].id, index[j].id)) {
+                i++;
+            } else if (KeyCompare<T>::less(index[j].id, rowKeys[i].id)) {
+                j++;
+            } else {
+                rowEntries[i * columns + column].offset = index[j].offset;
+                rowEntries[i * columns + column].length = index[j].length;
+                i++;
+                j++;
+            }
+        }
+    }
+
+    try {
+        writeFileAtomically(fileName, {{buffer.data(), buffer.size()}});
+    } catch (const std::runtime_error &e) {
+        throw Php::Exception(e.what());
+    }
+}
+
+template<typename T>
+bool MultiDBReader<T>::loadCache(const std::string &fileName, uint64_t stamp) {
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fileno(file), &sb) != 0 || static_cast<size_t>(sb.st_size) < sizeof(MultiIndexHeader)) {
+        fclose(file);
+        return false;
+    }
+
+    ssize_t fileSize;
+    char *map = mmapData(file, &fileSize, false);
+    fclose(file);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const MultiIndexHeader *header = (const MultiIndexHeader *) map;
+    size_t entryCount = static_cast<size_t>(header->entries);
+    size_t keyBytes = (entryCount * sizeof(Key) + 7) & ~static_cast<size_t>(7);
+    if (header->magic != MultiIndexHeader::MAGIC || header->keySize != sizeof(Key) || header->columns != columns
+        || header->indexStamp != stamp
+        || sizeof(MultiIndexHeader) + keyBytes + entryCount * columns * sizeof(Entry) != static_cast<size_t>(fileSize)) {
+        munmap(map, static_cast<size_t>(fileSize));
+        return false;
+    }
+
+    cache = map;
+    cacheSize = static_cast<size_t>(fileSize);
+    size = entryCount;
+    keys = (Key *) (map + sizeof(MultiIndexHeader));
+    entries = (Entry *) (map + sizeof(MultiIndexHeader) + keyBytes);
+    return true;
+}
+
+template<typename T>
+size_t MultiDBReader<T>::findRow(const Php::Value &dbKey) {
+    Key key;
+    if (!readParameterKey<T>(&key.id, dbKey)) {
+        return size;
+    }
+
+    const Key *row = std::lower_bound(keys, keys + size, key, [](const Key &x, const Key &y) {
+        return KeyCompare<T>::less(x.id, y.id);
+    });
+
+    if (row == keys + size || !KeyCompare<T>::equal(row->id, key.id)) {
+        return size;
+    }
+    return static_cast<size_t>(row - keys);
+}
+
+template<typename T>
+Php::Value MultiDBReader<T>::getColumnData(size_t id, size_t column) {
+    const Entry &entry = entries[id * columns + column];
+    if (entry.length == 0) {
+        return nullptr;
+    }
+
+    if (entry.offset >= static_cast<size_t>(dataSizes[column])
+        || entry.offset + entry.length > static_cast<size_t>(dataSizes[column])) {
+        throw Php::Exception("Invalid database read");
+    }
+
+    return Php::Value(data[column] + entry.offset, static_cast<int>(entry.length - 1));
+}
+
+template<typename T>
+Php::Value MultiDBReader<T>::getId(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    size_t id = findRow(params[0]);
+    if (id == size) {
+        throw Php::Exception("Key not found in index");
+    }
+    return (int64_t) id;
+}
+
+template<typename T>
+Php::Value MultiDBReader<T>::getDbKey(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    size_t id = static_cast<size_t>((int64_t) params[0]);
+
+    checkBounds(id, size);
+
+    return keyValue<T>(keys[id].id);
+}
+
+template<typename T>
+Php::Value MultiDBReader<T>::getRow(Php::Parameters &params) {
+    if (params.size() < 1) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    size_t id = findRow(params[0]);
+    if (id == size) {
+        throw Php::Exception("Key not found in index");
+    }
+
+    Php::Array row;
+    for (size_t column = 0; column < columns; column++) {
+        row[static_cast<int>(column)] = getColumnData(id, column);
+    }
+    return row;
+}
+
+template<typename T>
+Php::Value MultiDBReader<T>::getData(Php::Parameters &params) {
+    if (params.size() < 2) {
+        throw Php::Exception("Not enough parameters");
+    }
+
+    size_t id = static_cast<size_t>((int64_t) params[0]);
+    size_t column = static_cast<size_t>((int64_t) params[1]);
+
+    checkBounds(id, size);
+    checkBounds(column, columns);
+
+    return getColumnData(id, column);
+}
+
+template
+class MultiDBReader<int32_t>;
+
+template
+class MultiDBReader<char[32]>;
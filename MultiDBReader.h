@@ -0,0 +1,77 @@
+#ifndef MULTIDBREADER_H
+#define MULTIDBREADER_H
+
+// Reads several ffindex DBs that share the same keys, e.g. a sequence DB and its _h header DB.
+// A single key index maps every key to the offset and length of its entry in each column DB,
+// so one lookup returns the whole row.
+//
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <phpcpp.h>
+
+#include "DBReader.h"
+
+template<typename T>
+class MultiDBReader : public Php::Base {
+public:
+    void __construct(Php::Parameters &params);
+
+    void __destruct();
+
+    Php::Value getSize() {
+        return (int64_t) size;
+    }
+
+    Php::Value getColumns() {
+        return (int64_t) columns;
+    }
+
+    // does a binary search in the key index and returns the row id of dbKey
+    Php::Value getId(Php::Parameters &params);
+
+    Php::Value getDbKey(Php::Parameters &params);
+
+    // returns the entries of all columns for dbKey, missing entries are null
+    Php::Value getRow(Php::Parameters &params);
+
+    // returns the entry of a single column for a row id
+    Php::Value getData(Php::Parameters &params);
+
+    struct Key {
+        T id;
+    };
+
+    struct Entry {
+        size_t offset;
+        size_t length;
+    };
+
+private:
+    size_t columns;
+    std::vector<std::string> dataFileNames;
+    std::vector<FILE *> dataFiles;
+    std::vector<char *> data;
+    std::vector<ssize_t> dataSizes;
+
+    // number of rows in the key index
+    size_t size;
+    Key *keys;
+    // columns entries per row
+    Entry *entries;
+
+    void *cache;
+    size_t cacheSize;
+
+    void buildCache(const std::vector<std::string> &indexFileNames, const std::string &fileName, uint64_t stamp);
+    // returns false if the cache is missing, invalid or was built from other index files
+    bool loadCache(const std::string &fileName, uint64_t stamp);
+    void release();
+
+    size_t findRow(const Php::Value &dbKey);
+    Php::Value getColumnData(size_t id, size_t column);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef RECORDPARSER_H
+#define RECORDPARSER_H
+
+// Helpers to split tab separated entries (e.g. MMseqs alignment results)
+// into typed fields straight from the database memory.
+//
+
+#include <cstddef>
+#include <cstdlib>
+#include <stdint.h>
+#include <locale.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// returns the position of the next tab or newline or end if there is none
+inline const char *findDelimiter(const char *pos, const char *end) {
+#ifdef __SSE2__
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    // never load past end, the entry might end right at a page boundary
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, newline)));
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < end && *pos != '\t' && *pos != '\n') {
+        pos++;
+    }
+    return pos;
+}
+
+inline int64_t parseInt(const char *pos, const char *end) {
+    bool negative = false;
+    if (pos < end && (*pos == '-' || *pos == '+')) {
+        negative = (*pos == '-');
+        pos++;
+    }
+
+    int64_t value = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9') {
+        value = value * 10 + (*pos - '0');
+        pos++;
+    }
+    return negative ? -value : value;
+}
+
+// strtod follows LC_NUMERIC, which PHP extensions or setlocale() calls might change
+inline locale_t numericLocale() {
+    static locale_t locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+    return locale;
+}
+
+// the field has to be followed by a delimiter or a null byte
+inline double parseFloat(const char *pos, const char *end) {
+    while (pos < end && *pos == ' ') {
+        pos++;
+    }
+    // strtod would skip the delimiter of an empty field and parse the next one
+    if (pos == end) {
+        return 0.0;
+    }
+    return strtod_l(pos, NULL, numericLocale());
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <phpcpp.h>
 #include "DBReader.h"
+#include "MultiDBReader.h"
 #include "DBWriter.h"
 
 extern "C" {
@@ -21,13 +22,25 @@ extern "C" {
         intDB.method("getDataSize", &DBReader<int32_t>::getDataSize);
         intDB.method("getSize", &DBReader<int32_t>::getSize);
         intDB.method("getData", &DBReader<int32_t>::getData);
+        intDB.method("getDataBatch", &DBReader<int32_t>::getDataBatch);
+        intDB.method("getStream", &DBReader<int32_t>::getStream);
+        intDB.method("getDataSlice", &DBReader<int32_t>::getDataSlice);
+        intDB.method("getDataLine", &DBReader<int32_t>::getDataLine);
+        intDB.method("getRecords", &DBReader<int32_t>::getRecords);
+        intDB.method("getRecordsBatch", &DBReader<int32_t>::getRecordsBatch);
         intDB.method("getDbKey", &DBReader<int32_t>::getDbKey);
         intDB.method("getLength", &DBReader<int32_t>::getLength);
         intDB.method("getOffset", &DBReader<int32_t>::getOffset);
         intDB.method("getId", &DBReader<int32_t>::getId);
+        intDB.method("getIds", &DBReader<int32_t>::getIds);
+        intDB.method("openLookup", &DBReader<int32_t>::openLookup);
+        intDB.method("getLookupKey", &DBReader<int32_t>::getLookupKey);
+        intDB.method("getIdByAccession", &DBReader<int32_t>::getIdByAccession);
 
         intDB.property("USE_DATA", "1", Php::Public | Php::Static);
         intDB.property("USE_WRITABLE", "2", Php::Public | Php::Static);
+        intDB.property("USE_SHARED", "4", Php::Public | Php::Static);
+        intDB.property("USE_PREAD", "8", Php::Public | Php::Static);
 
         extension.add(std::move(intDB));
 
@@ -37,20 +50,54 @@ extern "C" {
         stringDB.method("getDataSize", &DBReader<char[32]>::getDataSize);
         stringDB.method("getSize", &DBReader<char[32]>::getSize);
         stringDB.method("getData", &DBReader<char[32]>::getData);
+        stringDB.method("getDataBatch", &DBReader<char[32]>::getDataBatch);
+        stringDB.method("getStream", &DBReader<char[32]>::getStream);
+        stringDB.method("getDataSlice", &DBReader<char[32]>::getDataSlice);
+        stringDB.method("getDataLine", &DBReader<char[32]>::getDataLine);
+        stringDB.method("getRecords", &DBReader<char[32]>::getRecords);
+        stringDB.method("getRecordsBatch", &DBReader<char[32]>::getRecordsBatch);
         stringDB.method("getDbKey", &DBReader<char[32]>::getDbKey);
         stringDB.method("getLength", &DBReader<char[32]>::getLength);
         stringDB.method("getOffset", &DBReader<char[32]>::getOffset);
         stringDB.method("getId", &DBReader<char[32]>::getId);
+        stringDB.method("getIds", &DBReader<char[32]>::getIds);
 
         stringDB.property("USE_DATA", "1", Php::Public | Php::Static);
         stringDB.property("USE_WRITABLE", "2", Php::Public | Php::Static);
+        stringDB.property("USE_SHARED", "4", Php::Public | Php::Static);
+        stringDB.property("USE_PREAD", "8", Php::Public | Php::Static);
 
         extension.add(std::move(stringDB));
 
+        Php::Class<MultiDBReader<int32_t>> intMultiDB("IntMultiDBReader");
+        intMultiDB.method("__construct", &MultiDBReader<int32_t>::__construct);
+        intMultiDB.method("__destruct", &MultiDBReader<int32_t>::__destruct);
+        intMultiDB.method("getSize", &MultiDBReader<int32_t>::getSize);
+        intMultiDB.method("getColumns", &MultiDBReader<int32_t>::getColumns);
+        intMultiDB.method("getId", &MultiDBReader<int32_t>::getId);
+        intMultiDB.method("getDbKey", &MultiDBReader<int32_t>::getDbKey);
+        intMultiDB.method("getRow", &MultiDBReader<int32_t>::getRow);
+        intMultiDB.method("getData", &MultiDBReader<int32_t>::getData);
+
+        extension.add(std::move(intMultiDB));
+
+        Php::Class<MultiDBReader<char[32]>> stringMultiDB("StringMultiDBReader");
+        stringMultiDB.method("__construct", &MultiDBReader<char[32]>::__construct);
+        stringMultiDB.method("__destruct", &MultiDBReader<char[32]>::__destruct);
+        stringMultiDB.method("getSize", &MultiDBReader<char[32]>::getSize);
+        stringMultiDB.method("getColumns", &MultiDBReader<char[32]>::getColumns);
+        stringMultiDB.method("getId", &MultiDBReader<char[32]>::getId);
+        stringMultiDB.method("getDbKey", &MultiDBReader<char[32]>::getDbKey);
+        stringMultiDB.method("getRow", &MultiDBReader<char[32]>::getRow);
+        stringMultiDB.method("getData", &MultiDBReader<char[32]>::getData);
+
+        extension.add(std::move(stringMultiDB));
+
         Php::Class<PhpDBWriter> intDBWriter("IntDBWriter");
         intDBWriter.method("__construct", &PhpDBWriter::__construct);
         intDBWriter.method("__destruct", &PhpDBWriter::__destruct);
         intDBWriter.method("write", &PhpDBWriter::write);
+        intDBWriter.method("close", &PhpDBWriter::close);
 
 
         intDBWriter.property("ASCII_MODE", "0", Php::Public | Php::Static);